@@ -0,0 +1,77 @@
+#pragma once
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <utility>
+
+#include "Derivative.h"
+#include "DiffValue.h"
+
+// Reference counts aren't atomic in single-threaded mode, so a graph can't be
+// swept on one thread while another builds on its leaves.
+#ifndef LENINGRAD_SINGLE_THREADED
+
+namespace leningrad {
+
+/**
+ * Runs a task on some other thread, e.g. by posting it to a thread pool.
+ */
+using Executor = std::function<void(std::function<void()>)>;
+
+namespace impl {
+template <typename R, typename F>
+std::future<R> runOn(const Executor &executor, F &&fn) {
+    if (!executor) {
+        return std::async(std::launch::async, std::forward<F>(fn));
+    }
+    // std::function needs a copyable callable, and packaged_task isn't one
+    auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(fn));
+    std::future<R> result = task->get_future();
+    executor([task]() { (*task)(); });
+    return result;
+}
+} // namespace impl
+
+/**
+ * differentiate() on a background thread, so the caller can keep building
+ * the next graph while this one is swept, e.g. the forward pass of sample
+ * k + 1 during the backward pass of sample k.
+ *
+ * The task holds its own reference to the graph, so value may be destroyed
+ * straight away. The new graph may share leaves and other nodes with the
+ * one being swept, since sweeping only reads it. Sweeps with
+ * GraphRetention::Release modify the graph, so they must not overlap with
+ * other sweeps over shared nodes. By default each call runs on a new
+ * thread; pass an executor to reuse threads instead.
+ */
+template <typename T>
+std::future<DerivativeResult<T>>
+differentiateAsync(DiffValue<T> value,
+                   GraphRetention retention = GraphRetention::Retain,
+                   const Executor &executor = nullptr) {
+    return impl::runOn<DerivativeResult<T>>(
+        executor, [value = std::move(value), retention]() {
+            return differentiate(value, retention);
+        });
+}
+
+/**
+ * gradient() on a background thread, with the same rules as
+ * differentiateAsync().
+ */
+template <typename Acc = void, typename T>
+auto gradientAsync(DiffValue<T> value, Summation summation = Summation::Naive,
+                   GraphRetention retention = GraphRetention::Retain,
+                   const Executor &executor = nullptr) {
+    using R = decltype(gradient<Acc>(value, summation, retention));
+    return impl::runOn<R>(executor,
+                          [value = std::move(value), summation, retention]() {
+                              return gradient<Acc>(value, summation,
+                                                   retention);
+                          });
+}
+
+} // namespace leningrad
+
+#endif
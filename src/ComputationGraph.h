@@ -1,9 +1,16 @@
 #pragma once
 
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "IntrusivePtr.h"
+#include "NodeAllocator.h"
+
 namespace leningrad {
 template <typename T> class DiffValue;
 }
@@ -12,13 +19,83 @@ namespace leningrad::impl {
 
 template <typename T> class Node;
 
+// With LENINGRAD_SINGLE_THREADED defined, nodes are reference counted
+// intrusively with non-atomic counts. Graphs must then only be touched from
+// one thread at a time.
+#ifdef LENINGRAD_SINGLE_THREADED
+template <typename T> using NodePtr = IntrusivePtr<Node<T>>;
+#else
+template <typename T> using NodePtr = std::shared_ptr<Node<T>>;
+#endif
+
+template <typename T> struct Edge;
+
+// Converts the values a numeric partial reads to the type it is computed in.
+template <typename Acc> struct Widen {
+    template <typename X> Acc operator()(X x) const {
+        return static_cast<Acc>(x);
+    }
+};
+
+/**
+ * An edge's partial derivative as a plain number, computed from the values
+ * of its node, the node's children and the edge's scalar. Numeric sweeps
+ * evaluate it in their accumulator type instead of building the partial as
+ * a DiffValue, so they allocate nothing per edge.
+ */
+template <typename T> struct NumericPartial {
+    template <typename Acc>
+    using Rule = Acc (*)(Widen<Acc>, const Node<T> &, const Edge<T> &);
+
+    Rule<float> inFloat;
+    Rule<double> inDouble;
+    Rule<long double> inLongDouble;
+
+    template <typename Acc>
+    Acc operator()(const Node<T> &node, const Edge<T> &edge) const {
+        if constexpr (std::is_same_v<Acc, float>) {
+            return inFloat(Widen<float>(), node, edge);
+        } else if constexpr (std::is_same_v<Acc, double>) {
+            return inDouble(Widen<double>(), node, edge);
+        } else {
+            return static_cast<Acc>(
+                inLongDouble(Widen<long double>(), node, edge));
+        }
+    }
+};
+
+/**
+ * The NumericPartial of a rule, a captureless generic lambda taking a
+ * Widen<Acc>, the node and the edge, and returning an Acc.
+ */
+template <typename T, typename Rule>
+const NumericPartial<T> *numericPartial(Rule rule) {
+    static const NumericPartial<T> partial{rule, rule, rule};
+    return &partial;
+}
+
+/**
+ * The NumericPartial of edges whose partial is known when they are created,
+ * and stored as their scalar.
+ */
+template <typename T> const NumericPartial<T> *scalarPartial() {
+    return numericPartial<T>([](auto in, const auto &, const auto &edge) {
+        return in(edge.scalar);
+    });
+}
+
 template <typename T> struct Edge {
-    Edge(std::shared_ptr<Node<T>> to,
-         const std::function<leningrad::DiffValue<T>()> &derivativeFn)
-        : to(to), derivativeFn(derivativeFn) {}
+    Edge(NodePtr<T> to, std::function<leningrad::DiffValue<T>()> derivativeFn,
+         const NumericPartial<T> *partial = nullptr, T scalar = T(0))
+        : to(std::move(to)), derivativeFn(std::move(derivativeFn)),
+          partial(partial), scalar(scalar) {}
 
-    const std::shared_ptr<Node<T>> to;
-    const std::function<leningrad::DiffValue<T>()> derivativeFn;
+    NodePtr<T> to;
+    std::function<leningrad::DiffValue<T>()> derivativeFn;
+    // Without a numeric partial, numeric sweeps evaluate derivativeFn.
+    const NumericPartial<T> *partial;
+    // a number the numeric partial reads, e.g. a scalar operand
+    T scalar;
 };
 
 template <typename T> class Node {
@@ -28,10 +105,110 @@ public:
     Node(T value, const std::vector<Edge<T>> &edges)
         : value(value), edges(edges) {}
 
-    Node(T value, const std::vector<Edge<T>> &&edges)
-        : value(value), edges(edges) {}
+    Node(T value, std::vector<Edge<T>> &&edges)
+        : value(value), edges(std::move(edges)) {}
+
+    Node(const Node &) = delete;
+    Node &operator=(const Node &) = delete;
+
+    ~Node() { releaseEdges(); }
+
+    /**
+     * Drops this node's edges, and with them the derivative closures and any
+     * part of the graph only reachable through them. The node then acts as
+     * a constant.
+     */
+    void releaseEdges() {
+        // Destroying a long chain of nodes recursively would overflow the
+        // stack, so children that die with this node are torn down
+        // iteratively instead.
+        std::vector<NodePtr<T>> dying;
+        releaseUniqueChildren(dying);
+        std::vector<Edge<T>>().swap(edges);
+        while (!dying.empty()) {
+            NodePtr<T> node = std::move(dying.back());
+            dying.pop_back();
+            node->releaseUniqueChildren(dying);
+        }
+    }
+
+    // What the simplification rules in DiffArithmetic.h can see through:
+    // constants, which are leaves no derivative is ever taken wrt, and
+    // negations. Nonlocal marks nodes whose partials depend on more than
+    // their children, which hessian() can't differentiate locally.
+    enum Flag : std::uint8_t { Constant = 1, Negation = 2, Nonlocal = 4 };
+
+    bool has(Flag flag) const { return (flags & flag) != 0; }
+
+    void set(Flag flag) { flags |= flag; }
 
     const T value;
-    const std::vector<Edge<T>> edges;
+    // kept next to value, where it fits in the padding before edges
+    std::uint8_t flags = 0;
+    std::vector<Edge<T>> edges;
+
+private:
+    void releaseUniqueChildren(std::vector<NodePtr<T>> &dying) {
+        // closures usually hold the other references to the children
+        for (Edge<T> &edge : edges) {
+            edge.derivativeFn = nullptr;
+        }
+        for (Edge<T> &edge : edges) {
+            if (edge.to.use_count() == 1) {
+                dying.push_back(std::move(edge.to));
+            }
+        }
+    }
+
+public:
+#ifdef LENINGRAD_SINGLE_THREADED
+    std::size_t refCount = 0;
+    std::pmr::memory_resource *resource = nullptr;
+
+    static void destroy(Node *node) {
+        std::pmr::memory_resource *resource = node->resource;
+        node->~Node();
+        resource->deallocate(node, sizeof(Node), alignof(Node));
+    }
+#endif
 };
+
+/**
+ * Is told about every node of type T created on the thread it is installed
+ * on, e.g. a SpillTape.
+ */
+template <typename T> class NodeObserver {
+public:
+    virtual ~NodeObserver() = default;
+    virtual void nodeCreated(const NodePtr<T> &node) = 0;
+};
+
+template <typename T> NodeObserver<T> *&currentNodeObserver() {
+    thread_local NodeObserver<T> *observer = nullptr;
+    return observer;
+}
+
+template <typename T, typename... Args> NodePtr<T> makeNode(Args &&...args) {
+#ifdef LENINGRAD_SINGLE_THREADED
+    std::pmr::memory_resource *resource = getNodeResource();
+    void *memory = resource->allocate(sizeof(Node<T>), alignof(Node<T>));
+    Node<T> *raw;
+    try {
+        raw = new (memory) Node<T>(std::forward<Args>(args)...);
+    } catch (...) {
+        resource->deallocate(memory, sizeof(Node<T>), alignof(Node<T>));
+        throw;
+    }
+    raw->resource = resource;
+    NodePtr<T> node(raw);
+#else
+    auto node = std::allocate_shared<Node<T>>(
+        std::pmr::polymorphic_allocator<Node<T>>(getNodeResource()),
+        std::forward<Args>(args)...);
+#endif
+    if (NodeObserver<T> *observer = currentNodeObserver<T>()) {
+        observer->nodeCreated(node);
+    }
+    return node;
+}
 } // namespace leningrad::impl
@@ -1,12 +1,37 @@
 #pragma once
 
+#if __cplusplus > 202002L && __has_include(<stdfloat>)
+#include <stdfloat>
+#endif
+
 #include "Derivative.h"
 #include "DiffArithmetic.h"
 #include "DiffComparison.h"
 #include "DiffOps.h"
 #include "DiffValue.h"
+#include "ExternTemplates.h"
+
+// The optional modules (AsyncDerivative.h, Hessian.h, SpillTape.h, ...) are
+// not included here, so that code which doesn't use them doesn't compile
+// them. Include them directly.
 
 namespace leningrad {
 using ddouble = DiffValue<double>;
 using dfloat = DiffValue<float>;
+
+#ifdef __STDCPP_FLOAT16_T__
+using dhalf = DiffValue<std::float16_t>;
+
+template <> struct AccumulatorType<std::float16_t> {
+    using type = float;
+};
+#endif
+
+#ifdef __STDCPP_BFLOAT16_T__
+using dbfloat16 = DiffValue<std::bfloat16_t>;
+
+template <> struct AccumulatorType<std::bfloat16_t> {
+    using type = float;
+};
+#endif
 } // namespace leningrad
@@ -1,66 +1,331 @@
 #pragma once
 
+#include "DiffArithmetic.h"
 #include "DiffValue.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
 #include <initializer_list>
-#include <list>
 #include <memory>
+#include <mutex>
+#include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 namespace leningrad {
 
+namespace impl {
+/**
+ * The derivatives of a node wrt everything it depends on, as built by
+ * differentiate().
+ */
+template <typename T> struct AdjointCache {
+    std::unordered_map<const Node<T> *, DiffValue<T>> derivatives;
+    // keeps the keys alive
+    std::vector<NodePtr<T>> nodes;
+};
+} // namespace impl
+
 template <typename T> class DerivativeResult {
 public:
-    explicit DerivativeResult(
-        const std::unordered_map<std::shared_ptr<impl::Node<T>>, DiffValue<T>>
-            &derivativeMap)
-        : derivativeMap(derivativeMap) {}
+    DerivativeResult(impl::NodePtr<T> root,
+                     std::shared_ptr<const impl::AdjointCache<T>> cache)
+        : root(std::move(root)), cache(std::move(cache)) {}
 
-    DiffValue<T> wrt(const DiffValue<T> &value) {
-        auto itr = derivativeMap.find(impl::getDiffValueNode(value));
-        return itr != derivativeMap.end() ? itr->second : 0;
+    DiffValue<T> wrt(const DiffValue<T> &value) const {
+        auto itr = cache->derivatives.find(impl::getDiffValueNode(value).get());
+        if (itr == cache->derivatives.end()) {
+            return 0;
+        }
+        // derivatives that were simplified to constants are handed out as
+        // fresh leaves, so they can still be used as variables
+        return impl::isConstant(itr->second) ? DiffValue<T>(itr->second.value())
+                                             : itr->second;
     }
 
-    bool hasDerivative(const DiffValue<T> &value) {
-        return derivativeMap.find(impl::getDiffValueNode(value)) !=
-               derivativeMap.end();
+    bool hasDerivative(const DiffValue<T> &value) const {
+        return cache->derivatives.count(impl::getDiffValueNode(value).get());
     }
 
 private:
-    std::unordered_map<std::shared_ptr<impl::Node<T>>, DiffValue<T>>
-        derivativeMap;
+    impl::NodePtr<T> root;
+    std::shared_ptr<const impl::AdjointCache<T>> cache;
 };
 
+/**
+ * What differentiate() and gradient() do with the graph they sweep over.
+ */
+enum class GraphRetention {
+    // leave the graph intact, so it can be differentiated again
+    Retain,
+    // consume the graph: each node's edges (and the values captured by
+    // them) are released as soon as its adjoint has been propagated, so
+    // memory drops steadily during the sweep. Differentiating any value that
+    // shares the graph afterwards treats the released nodes as constants.
+    Release,
+};
+
+template <typename T> class DerivativeCache;
+
+namespace impl {
+/**
+ * Lists the nodes reachable from root such that every node comes before the
+ * nodes it has edges to, without recursing. If positions is given, it is
+ * filled with the index of each node in the returned order. Nodes in stopAt
+ * are listed, but nothing is reached through them.
+ */
 template <typename T>
-DerivativeResult<T> differentiate(const DiffValue<T> &value) {
-    std::list<std::shared_ptr<impl::Node<T>>> fringe{
-        impl::getDiffValueNode(value)};
-    std::unordered_map<std::shared_ptr<impl::Node<T>>, DiffValue<T>>
-        derivativeMap;
-    derivativeMap.insert({impl::getDiffValueNode(value), 1.0});
-    while (!fringe.empty()) {
-        auto node = fringe.front();
-        fringe.pop_front();
-        DiffValue<T> nodeDerivative = derivativeMap.at(node);
-        for (const impl::Edge<T> &edge : node->edges) {
-            auto next = edge.to;
-            DiffValue<T> intermediateDerivative = edge.derivativeFn();
-            auto resultPair = derivativeMap.insert({next, 0});
-            derivativeMap.at(next) += intermediateDerivative * nodeDerivative;
-            if (resultPair.second) {
-                fringe.push_back(next);
+std::vector<NodePtr<T>> topologicalOrder(
+    const NodePtr<T> &root,
+    std::unordered_map<const Node<T> *, std::size_t> *positions = nullptr,
+    const std::unordered_set<const Node<T> *> *stopAt = nullptr) {
+    std::unordered_map<const Node<T> *, std::size_t> localPositions;
+    auto &finished = positions ? *positions : localPositions;
+    finished.clear();
+
+    std::vector<NodePtr<T>> order;
+    std::unordered_set<const Node<T> *> visited{root.get()};
+    std::vector<std::pair<const NodePtr<T> *, std::size_t>> stack{{&root, 0}};
+    while (!stack.empty()) {
+        auto &[node, nextEdge] = stack.back();
+        const auto &edges = (*node)->edges;
+        if (nextEdge < edges.size() &&
+            !(stopAt && stopAt->count(node->get()))) {
+            const NodePtr<T> &child = edges[nextEdge++].to;
+            if (visited.insert(child.get()).second) {
+                stack.emplace_back(&child, 0);
             }
+        } else {
+            finished.emplace(node->get(), order.size());
+            order.push_back(*node);
+            stack.pop_back();
         }
     }
-    return DerivativeResult<T>(derivativeMap);
+
+    std::reverse(order.begin(), order.end());
+    for (auto &entry : finished) {
+        entry.second = order.size() - 1 - entry.second;
+    }
+    return order;
 }
 
+/**
+ * Evaluates the edge's derivative rule. Rules return plain numbers as new
+ * leaves, which nothing else can refer to, so those are marked constant for
+ * the simplifications in DiffArithmetic.h.
+ */
+template <typename T> DiffValue<T> evaluateDerivative(const Edge<T> &edge) {
+    DiffValue<T> derivative = edge.derivativeFn();
+    const NodePtr<T> &node = getDiffValueNode(derivative);
+    if (node->edges.empty() && node.use_count() == 1) {
+        node->set(Node<T>::Constant);
+    }
+    return derivative;
+}
+
+/**
+ * The numeric value of evaluateDerivative() for an edge of node, computed in
+ * Acc, without building the derivative if the edge has a numeric partial.
+ */
+template <typename Acc, typename T>
+Acc edgePartial(const Node<T> &node, const Edge<T> &edge) {
+    if (edge.partial == nullptr) {
+        return static_cast<Acc>(edge.derivativeFn().value());
+    }
+    return edge.partial->template operator()<Acc>(node, edge);
+}
+
+/**
+ * Builds the derivatives of root wrt everything it depends on, reusing and
+ * filling cache if it is given.
+ */
+template <typename T>
+std::shared_ptr<const AdjointCache<T>>
+buildAdjoints(const NodePtr<T> &root, GraphRetention retention,
+              DerivativeCache<T> *cache);
+} // namespace impl
+
+/**
+ * Derivative graphs kept between calls to differentiate(), for values that
+ * are differentiated more than once: again, wrt other variables, or to
+ * higher orders. Differentiating with a cache reuses the graphs built by
+ * earlier differentiations with it, for the whole result and for each edge,
+ * instead of building identical ones.
+ *
+ * The cache keeps everything it has seen alive, until it is cleared or
+ * destroyed. It may be shared between threads.
+ */
+template <typename T> class DerivativeCache {
+public:
+    DerivativeCache() = default;
+    DerivativeCache(const DerivativeCache &) = delete;
+    DerivativeCache &operator=(const DerivativeCache &) = delete;
+
+    void clear() {
+        std::unordered_map<const impl::Node<T> *, Entry> dropped;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            dropped.swap(entries);
+        }
+    }
+
+private:
+    struct Entry {
+        // keeps the key alive, and with it the addresses of its edges
+        impl::NodePtr<T> node;
+        std::shared_ptr<const impl::AdjointCache<T>> adjoints;
+        // by edge index, null until built
+        std::vector<impl::NodePtr<T>> edgeDerivatives;
+    };
+
+    Entry &entry(const impl::NodePtr<T> &node) {
+        Entry &entry = entries[node.get()];
+        if (!entry.node) {
+            entry.node = node;
+            entry.edgeDerivatives.resize(node->edges.size());
+        }
+        return entry;
+    }
+
+    std::shared_ptr<const impl::AdjointCache<T>>
+    adjoints(const impl::NodePtr<T> &node) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto itr = entries.find(node.get());
+        return itr != entries.end() ? itr->second.adjoints : nullptr;
+    }
+
+    // keeps the adjoints stored first, and returns them
+    std::shared_ptr<const impl::AdjointCache<T>>
+    storeAdjoints(const impl::NodePtr<T> &node,
+                  std::shared_ptr<const impl::AdjointCache<T>> adjoints) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry &stored = entry(node);
+        if (!stored.adjoints) {
+            stored.adjoints = std::move(adjoints);
+        }
+        return stored.adjoints;
+    }
+
+    DiffValue<T> edgeDerivative(const impl::NodePtr<T> &node, std::size_t i) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            const impl::NodePtr<T> &cached = entry(node).edgeDerivatives[i];
+            if (cached) {
+                return impl::createDiffValueFromNode(cached);
+            }
+        }
+        // built without the lock. Threads that race here all build a
+        // derivative, and all return the one that was stored first.
+        DiffValue<T> derivative = impl::evaluateDerivative(node->edges[i]);
+        std::lock_guard<std::mutex> lock(mutex);
+        impl::NodePtr<T> &cached = entry(node).edgeDerivatives[i];
+        if (!cached) {
+            cached = impl::getDiffValueNode(derivative);
+        }
+        return impl::createDiffValueFromNode(cached);
+    }
+
+    std::mutex mutex;
+    std::unordered_map<const impl::Node<T> *, Entry> entries;
+
+    friend std::shared_ptr<const impl::AdjointCache<T>>
+    impl::buildAdjoints<T>(const impl::NodePtr<T> &root,
+                           GraphRetention retention,
+                           DerivativeCache<T> *cache);
+};
+
+namespace impl {
+template <typename T>
+std::shared_ptr<const AdjointCache<T>>
+buildAdjoints(const NodePtr<T> &root, GraphRetention retention,
+              DerivativeCache<T> *cache) {
+    if (cache) {
+        if (auto cached = cache->adjoints(root)) {
+            return cached;
+        }
+    }
+    std::unordered_map<const Node<T> *, std::size_t> positions;
+    auto order = topologicalOrder(root, &positions);
+
+    // every contribution to a node's derivative is known by the time it is
+    // reached, so each derivative is built as a single sum node
+    std::vector<std::vector<DiffValue<T>>> contributions(order.size());
+    contributions[0].push_back(constant(T(1)));
+    auto adjoints = std::make_shared<AdjointCache<T>>();
+    adjoints->derivatives.reserve(order.size());
+    adjoints->nodes.reserve(order.size());
+    for (std::size_t i = 0; i < order.size(); i++) {
+        DiffValue<T> nodeDerivative =
+            contributions[i].size() == 1
+                ? std::move(contributions[i].front())
+                : sum(contributions[i].begin(), contributions[i].end());
+        contributions[i] = {};
+        const auto &edges = order[i]->edges;
+        for (std::size_t e = 0; e < edges.size(); e++) {
+            contributions[positions.at(edges[e].to.get())].push_back(
+                (cache ? cache->edgeDerivative(order[i], e)
+                       : evaluateDerivative(edges[e])) *
+                nodeDerivative);
+        }
+        if (retention == GraphRetention::Release) {
+            order[i]->releaseEdges();
+            if (order[i].use_count() == 1) {
+                // nothing else refers to this node, so nothing can ask for
+                // its derivative either
+                order[i].reset();
+                continue;
+            }
+        }
+        adjoints->derivatives.emplace(order[i].get(),
+                                      std::move(nodeDerivative));
+        adjoints->nodes.push_back(std::move(order[i]));
+    }
+    if (cache) {
+        return cache->storeAdjoints(root, std::move(adjoints));
+    }
+    return adjoints;
+}
+} // namespace impl
+
+/**
+ * Builds the derivative graphs of value wrt everything it depends on. They
+ * belong to the result alone: differentiating value again builds them
+ * again, unless a DerivativeCache is used.
+ */
+template <typename T>
+DerivativeResult<T>
+differentiate(const DiffValue<T> &value,
+              GraphRetention retention = GraphRetention::Retain) {
+    const impl::NodePtr<T> &root = impl::getDiffValueNode(value);
+    return DerivativeResult<T>(
+        root, impl::buildAdjoints<T>(root, retention, nullptr));
+}
+
+/**
+ * As differentiate(value), but reusing the derivative graphs cache already
+ * holds, and adding the ones built to it. The graph is retained.
+ */
+template <typename T>
+DerivativeResult<T> differentiate(const DiffValue<T> &value,
+                                  DerivativeCache<T> &cache) {
+    const impl::NodePtr<T> &root = impl::getDiffValueNode(value);
+    return DerivativeResult<T>(
+        root, impl::buildAdjoints(root, GraphRetention::Retain, &cache));
+}
+
+// The repeated differentiations below share a cache, since each one sweeps
+// over the graphs the ones before it built.
+
 template <typename T>
 DiffValue<T> differentiate(const DiffValue<T> &value, const DiffValue<T> &x,
                            unsigned int order) {
+    DerivativeCache<T> cache;
     DiffValue<T> derivative = value;
-    for (int i = 0; i < order; i++) {
-        derivative = differentiate(derivative).wrt(x);
+    for (unsigned int i = 0; i < order; i++) {
+        derivative = differentiate(derivative, cache).wrt(x);
     }
     return derivative;
 }
@@ -74,11 +339,164 @@ DiffValue<T> differentiate(const DiffValue<T> &value,
 template <typename T, typename It>
 DiffValue<T> differentiate(const DiffValue<T> &value, const It &wrtBegin,
                            const It &wrtEnd) {
+    DerivativeCache<T> cache;
     DiffValue<T> derivative = value;
     for (auto it = wrtBegin; it != wrtEnd; it++) {
-        derivative = differentiate(derivative).wrt(*it);
+        derivative = differentiate(derivative, cache).wrt(*it);
     }
     return derivative;
 }
 
+/**
+ * How gradient() sums the contributions to each adjoint.
+ */
+enum class Summation {
+    Naive,
+    // Kahan-Babuska (Neumaier) compensated summation
+    Compensated,
+};
+
+/**
+ * The type gradient() accumulates adjoints in by default: one step wider
+ * than the type node values are stored in.
+ */
+template <typename T> struct AccumulatorType {
+    using type = std::conditional_t<std::is_same_v<T, float>, double, T>;
+};
+
+template <typename T>
+using AccumulatorTypeT = typename AccumulatorType<T>::type;
+
+/**
+ * Numeric first derivatives of a value, as computed by gradient().
+ */
+template <typename T, typename Acc> class GradientResult {
+public:
+    GradientResult(
+        std::vector<impl::NodePtr<T>> &&nodes,
+        std::unordered_map<const impl::Node<T> *, std::size_t> &&positions,
+        std::vector<Acc> &&adjoints)
+        : nodes(std::move(nodes)), positions(std::move(positions)),
+          adjoints(std::move(adjoints)) {}
+
+    Acc wrt(const DiffValue<T> &value) const {
+        auto itr = positions.find(impl::getDiffValueNode(value).get());
+        return itr != positions.end() ? adjoints[itr->second] : Acc(0);
+    }
+
+    bool hasDerivative(const DiffValue<T> &value) const {
+        return positions.find(impl::getDiffValueNode(value).get()) !=
+               positions.end();
+    }
+
+private:
+    // keeps the nodes alive, so the positions stay valid
+    std::vector<impl::NodePtr<T>> nodes;
+    std::unordered_map<const impl::Node<T> *, std::size_t> positions;
+    std::vector<Acc> adjoints;
+};
+
+namespace impl {
+/**
+ * Propagates numeric adjoints over nodes in topological order, starting from
+ * the given seeds (by position). Local partials are evaluated in the node
+ * type T, and everything else is done in Acc. When releasing the graph,
+ * nodes nothing else refers to are dropped from order and positions.
+ */
+template <typename Acc, typename T>
+std::vector<Acc> accumulateAdjoints(
+    std::vector<NodePtr<T>> &order,
+    std::unordered_map<const Node<T> *, std::size_t> &positions,
+    std::vector<Acc> &&adjoints, Summation summation,
+    GraphRetention retention = GraphRetention::Retain) {
+    adjoints.resize(order.size(), Acc(0));
+    std::vector<Acc> compensation;
+    if (summation == Summation::Compensated) {
+        compensation.resize(order.size(), Acc(0));
+    }
+    for (std::size_t i = 0; i < order.size(); i++) {
+        if (summation == Summation::Compensated) {
+            adjoints[i] += compensation[i];
+        }
+        Acc adjoint = adjoints[i];
+        if (adjoint == Acc(0)) {
+            continue;
+        }
+        for (const Edge<T> &edge : order[i]->edges) {
+            std::size_t j = positions.at(edge.to.get());
+            Acc term = edgePartial<Acc>(*order[i], edge) * adjoint;
+            if (summation == Summation::Compensated) {
+                Acc sum = adjoints[j] + term;
+                if (std::abs(adjoints[j]) >= std::abs(term)) {
+                    compensation[j] += (adjoints[j] - sum) + term;
+                } else {
+                    compensation[j] += (term - sum) + adjoints[j];
+                }
+                adjoints[j] = sum;
+            } else {
+                adjoints[j] += term;
+            }
+        }
+        if (retention == GraphRetention::Release) {
+            order[i]->releaseEdges();
+            if (order[i].use_count() == 1) {
+                positions.erase(order[i].get());
+                order[i].reset();
+            }
+        }
+    }
+    return std::move(adjoints);
+}
+} // namespace impl
+
+/**
+ * Computes the numeric first derivatives of value wrt everything it depends
+ * on, in one reverse sweep that builds no derivative graph. Adjoints are
+ * accumulated in Acc, which by default is wider than T, so values can be
+ * stored narrow (e.g. dfloat) without losing accuracy on large fan-in sums.
+ */
+template <typename Acc = void, typename T>
+auto gradient(const DiffValue<T> &value,
+              Summation summation = Summation::Naive,
+              GraphRetention retention = GraphRetention::Retain) {
+    using A = std::conditional_t<std::is_void_v<Acc>, AccumulatorTypeT<T>, Acc>;
+    std::unordered_map<const impl::Node<T> *, std::size_t> positions;
+    auto order = impl::topologicalOrder(impl::getDiffValueNode(value),
+                                        &positions);
+    std::vector<A> seed(order.size(), A(0));
+    seed[0] = A(1);
+    auto adjoints = impl::accumulateAdjoints<A>(
+        order, positions, std::move(seed), summation, retention);
+    if (retention == GraphRetention::Release) {
+        order.erase(std::remove_if(order.begin(), order.end(),
+                                   [](const auto &node) { return !node; }),
+                    order.end());
+    }
+    return GradientResult<T, A>(std::move(order), std::move(positions),
+                                std::move(adjoints));
+}
+
+/**
+ * Writes the numeric first derivatives of value wrt each of the inputs in
+ * [inputsBegin, inputsEnd) to out, in one sweep.
+ */
+template <typename T, typename It>
+void gradient(const DiffValue<T> &value, const It &inputsBegin,
+              const It &inputsEnd, T *out,
+              Summation summation = Summation::Naive) {
+    using A = AccumulatorTypeT<T>;
+    std::unordered_map<const impl::Node<T> *, std::size_t> positions;
+    auto order = impl::topologicalOrder(impl::getDiffValueNode(value),
+                                        &positions);
+    std::vector<A> seed(order.size(), A(0));
+    seed[0] = A(1);
+    auto adjoints = impl::accumulateAdjoints<A>(order, positions,
+                                                std::move(seed), summation);
+    for (auto it = inputsBegin; it != inputsEnd; ++it, ++out) {
+        auto itr = positions.find(impl::getDiffValueNode(*it).get());
+        *out = itr != positions.end() ? static_cast<T>(adjoints[itr->second])
+                                      : T(0);
+    }
+}
+
 } // namespace leningrad
@@ -1,133 +1,462 @@
 #pragma once
 
+#include <cmath>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
 #include "DiffValue.h"
 
 namespace leningrad {
 
-template <typename T> DiffValue<T> operator-(const DiffValue<T> &x) {
+namespace impl {
+/**
+ * A leaf that stands for a plain number rather than a variable, so the
+ * operators below may fold it away.
+ */
+template <typename T> DiffValue<T> constant(T value) {
+    auto node = makeNode<T>(value);
+    node->set(Node<T>::Constant);
+    return createDiffValueFromNode(std::move(node));
+}
+
+template <typename T> bool isConstant(const DiffValue<T> &x) {
+    return getDiffValueNode(x)->has(Node<T>::Constant);
+}
+
+template <typename T, typename U>
+bool isConstant(const DiffValue<T> &x, U value) {
+    return isConstant(x) && x.value() == static_cast<T>(value);
+}
+
+// x * 0 is only 0 if x is finite
+template <typename T> bool isFinite(const DiffValue<T> &x) {
+    return std::isfinite(x.value());
+}
+} // namespace impl
+
+// Operands are taken by value so that temporaries are moved into the graph
+// instead of copied, which saves reference count updates. Scalar operands
+// are converted to the value type first, so that an unsigned scalar is
+// never compared with -1 or negated as unsigned.
+//
+// Identities with constants (x * 1, x * 0, x + 0, x - x, -(-x), ...) are
+// simplified as the graph is built: they return an existing node or a
+// constant instead of a new node. This keeps derivative graphs, which are
+// full of them, small.
+
+template <typename T> DiffValue<T> operator-(DiffValue<T> x) {
     T value = -x.value();
+    if (impl::isConstant(x)) {
+        return impl::constant(value);
+    }
+    const auto &xNode = impl::getDiffValueNode(x);
+    if (xNode->has(impl::Node<T>::Negation) && !xNode->edges.empty()) {
+        return impl::createDiffValueFromNode(xNode->edges.front().to);
+    }
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(x), []() { return -1; });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(impl::releaseDiffValueNode(std::move(x)),
+                       []() { return -1; }, impl::scalarPartial<T>(), T(-1));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    node->set(impl::Node<T>::Negation);
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T>
-DiffValue<T> operator+(const DiffValue<T> &lhs, const DiffValue<T> &rhs) {
+DiffValue<T> operator+(DiffValue<T> lhs, DiffValue<T> rhs) {
     T value = lhs.value() + rhs.value();
+    if (impl::isConstant(lhs) && impl::isConstant(rhs)) {
+        return impl::constant(value);
+    } else if (impl::isConstant(lhs, 0)) {
+        return rhs;
+    } else if (impl::isConstant(rhs, 0)) {
+        return lhs;
+    }
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(lhs), []() { return 1; });
-    edges.emplace_back(impl::getDiffValueNode(rhs), []() { return 1; });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(impl::releaseDiffValueNode(std::move(lhs)),
+                       []() { return 1; }, impl::scalarPartial<T>(), T(1));
+    edges.emplace_back(impl::releaseDiffValueNode(std::move(rhs)),
+                       []() { return 1; }, impl::scalarPartial<T>(), T(1));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T, typename U>
-DiffValue<T> operator+(const DiffValue<T> &lhs, U rhs) {
-    T value = lhs.value() + rhs;
+DiffValue<T> operator+(DiffValue<T> lhs, U rhs) {
+    T r = static_cast<T>(rhs);
+    T value = lhs.value() + r;
+    if (impl::isConstant(lhs)) {
+        return impl::constant(value);
+    } else if (r == T(0)) {
+        return lhs;
+    }
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(lhs), []() { return 1; });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(impl::releaseDiffValueNode(std::move(lhs)),
+                       []() { return 1; }, impl::scalarPartial<T>(), T(1));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T, typename U>
-DiffValue<T> operator+(U lhs, const DiffValue<T> &rhs) {
-    return rhs + lhs;
+DiffValue<T> operator+(U lhs, DiffValue<T> rhs) {
+    return std::move(rhs) + lhs;
 }
 
 template <typename T>
-DiffValue<T> operator-(const DiffValue<T> &lhs, const DiffValue<T> &rhs) {
+DiffValue<T> operator-(DiffValue<T> lhs, DiffValue<T> rhs) {
     T value = lhs.value() - rhs.value();
+    if (impl::isConstant(lhs) && impl::isConstant(rhs)) {
+        return impl::constant(value);
+    } else if (impl::isConstant(rhs, 0)) {
+        return lhs;
+    } else if (impl::isConstant(lhs, 0)) {
+        return -std::move(rhs);
+    } else if (impl::getDiffValueNode(lhs) == impl::getDiffValueNode(rhs) &&
+               impl::isFinite(lhs)) {
+        return impl::constant(T(0));
+    }
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(lhs), []() { return 1; });
-    edges.emplace_back(impl::getDiffValueNode(rhs), []() { return -1; });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(impl::releaseDiffValueNode(std::move(lhs)),
+                       []() { return 1; }, impl::scalarPartial<T>(), T(1));
+    edges.emplace_back(impl::releaseDiffValueNode(std::move(rhs)),
+                       []() { return -1; }, impl::scalarPartial<T>(), T(-1));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T, typename U>
-DiffValue<T> operator-(const DiffValue<T> &lhs, U rhs) {
-    T value = lhs.value() - rhs;
+DiffValue<T> operator-(DiffValue<T> lhs, U rhs) {
+    T r = static_cast<T>(rhs);
+    T value = lhs.value() - r;
+    if (impl::isConstant(lhs)) {
+        return impl::constant(value);
+    } else if (r == T(0)) {
+        return lhs;
+    }
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(lhs), []() { return 1; });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(impl::releaseDiffValueNode(std::move(lhs)),
+                       []() { return 1; }, impl::scalarPartial<T>(), T(1));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T, typename U>
-DiffValue<T> operator-(U lhs, const DiffValue<T> &rhs) {
-    T value = lhs - rhs.value();
+DiffValue<T> operator-(U lhs, DiffValue<T> rhs) {
+    T l = static_cast<T>(lhs);
+    T value = l - rhs.value();
+    if (impl::isConstant(rhs)) {
+        return impl::constant(value);
+    } else if (l == T(0)) {
+        return -std::move(rhs);
+    }
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(rhs), []() { return -1; });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(impl::releaseDiffValueNode(std::move(rhs)),
+                       []() { return -1; }, impl::scalarPartial<T>(), T(-1));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T>
-DiffValue<T> operator*(const DiffValue<T> &lhs, const DiffValue<T> &rhs) {
+DiffValue<T> operator*(DiffValue<T> lhs, DiffValue<T> rhs) {
     T value = lhs.value() * rhs.value();
+    if (impl::isConstant(lhs) && impl::isConstant(rhs)) {
+        return impl::constant(value);
+    } else if ((impl::isConstant(lhs, 0) && impl::isFinite(rhs)) ||
+               (impl::isConstant(rhs, 0) && impl::isFinite(lhs))) {
+        return impl::constant(T(0));
+    } else if (impl::isConstant(lhs, 1)) {
+        return rhs;
+    } else if (impl::isConstant(rhs, 1)) {
+        return lhs;
+    } else if (impl::isConstant(lhs, -1)) {
+        return -std::move(rhs);
+    } else if (impl::isConstant(rhs, -1)) {
+        return -std::move(lhs);
+    }
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(lhs), [rhs]() { return rhs; });
-    edges.emplace_back(impl::getDiffValueNode(rhs), [lhs]() { return lhs; });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(lhs), [rhs]() { return rhs; },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return in(node.edges[1].to->value);
+        }));
+    edges.emplace_back(
+        impl::releaseDiffValueNode(std::move(rhs)),
+        [lhs = std::move(lhs)]() { return lhs; },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return in(node.edges[0].to->value);
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T, typename U>
-DiffValue<T> operator*(const DiffValue<T> &lhs, U rhs) {
-    T value = lhs.value() * rhs;
+DiffValue<T> operator*(DiffValue<T> lhs, U rhs) {
+    T r = static_cast<T>(rhs);
+    T value = lhs.value() * r;
+    if (impl::isConstant(lhs) || (r == T(0) && impl::isFinite(lhs))) {
+        return impl::constant(value);
+    } else if (r == T(1)) {
+        return lhs;
+    } else if (r == T(-1)) {
+        return -std::move(lhs);
+    }
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(lhs), [rhs]() { return rhs; });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(impl::releaseDiffValueNode(std::move(lhs)),
+                       [r]() { return r; }, impl::scalarPartial<T>(), r);
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T, typename U>
-DiffValue<T> operator*(U lhs, const DiffValue<T> &rhs) {
-    return rhs * lhs;
+DiffValue<T> operator*(U lhs, DiffValue<T> rhs) {
+    return std::move(rhs) * lhs;
 }
 
 template <typename T>
-DiffValue<T> operator/(const DiffValue<T> &lhs, const DiffValue<T> &rhs) {
+DiffValue<T> operator/(DiffValue<T> lhs, DiffValue<T> rhs) {
     T value = lhs.value() / rhs.value();
+    if (impl::isConstant(lhs) && impl::isConstant(rhs)) {
+        return impl::constant(value);
+    } else if (impl::isConstant(rhs, 1)) {
+        return lhs;
+    } else if (impl::isConstant(lhs, 0) && value == 0) {
+        return impl::constant(value);
+    }
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(lhs),
-                       [rhs]() { return static_cast<T>(1) / rhs; });
-    edges.emplace_back(impl::getDiffValueNode(rhs),
-                       [lhs, rhs]() { return -lhs / (rhs * rhs); });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(lhs),
+        [rhs]() { return static_cast<T>(1) / rhs; },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return 1 / in(node.edges[1].to->value);
+        }));
+    auto rhsNode = impl::getDiffValueNode(rhs);
+    edges.emplace_back(
+        std::move(rhsNode),
+        [lhs = std::move(lhs), rhs = std::move(rhs)]() {
+            return -lhs / (rhs * rhs);
+        },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto r = in(node.edges[1].to->value);
+            return -in(node.edges[0].to->value) / (r * r);
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T, typename U>
-DiffValue<T> operator/(const DiffValue<T> &lhs, U rhs) {
-    T value = lhs.value() / rhs;
+DiffValue<T> operator/(DiffValue<T> lhs, U rhs) {
+    T r = static_cast<T>(rhs);
+    T value = lhs.value() / r;
+    if (impl::isConstant(lhs)) {
+        return impl::constant(value);
+    } else if (r == T(1)) {
+        return lhs;
+    }
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(lhs),
-                       [rhs]() { return static_cast<T>(1) / rhs; });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::releaseDiffValueNode(std::move(lhs)),
+        [r]() { return static_cast<T>(1) / r; },
+        impl::numericPartial<T>([](auto in, const auto &, const auto &edge) {
+            return 1 / in(edge.scalar);
+        }),
+        r);
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T, typename U>
-DiffValue<T> operator/(U lhs, const DiffValue<T> &rhs) {
-    T value = lhs / rhs.value();
+DiffValue<T> operator/(U lhs, DiffValue<T> rhs) {
+    T l = static_cast<T>(lhs);
+    T value = l / rhs.value();
+    if (impl::isConstant(rhs) || (l == T(0) && value == 0)) {
+        return impl::constant(value);
+    }
+
+    std::vector<impl::Edge<T>> edges;
+    auto rhsNode = impl::getDiffValueNode(rhs);
+    edges.emplace_back(
+        std::move(rhsNode), [l, rhs = std::move(rhs)]() { return -l / (rhs * rhs); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &edge) {
+            auto r = in(node.edges[0].to->value);
+            return -in(edge.scalar) / (r * r);
+        }),
+        l);
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
+}
+
+namespace impl {
+template <typename T>
+DiffValue<T> sumNode(const std::vector<DiffValue<T>> &terms, T offset) {
+    // constant terms are folded into the offset
+    T value = offset;
+    const DiffValue<T> *variable = nullptr;
+    std::vector<impl::Edge<T>> edges;
+    edges.reserve(terms.size());
+    for (const DiffValue<T> &term : terms) {
+        value += term.value();
+        if (isConstant(term)) {
+            offset += term.value();
+        } else {
+            variable = &term;
+            edges.emplace_back(impl::getDiffValueNode(term),
+                               []() { return 1; }, scalarPartial<T>(), T(1));
+        }
+    }
+    if (edges.empty()) {
+        return constant(value);
+    } else if (edges.size() == 1 && offset == 0) {
+        return *variable;
+    }
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
+}
+
+// The partial derivative of a product wrt each of its factors is the product
+// of all the other factors, built from shared prefix and suffix products the
+// first time any of them is needed.
+template <typename T> class ProductPartials {
+public:
+    explicit ProductPartials(std::vector<DiffValue<T>> factors)
+        : factors(std::move(factors)) {}
+
+    DiffValue<T> get(std::size_t i) {
+        std::call_once(built, [this]() {
+            std::size_t n = factors.size();
+            prefix.reserve(n + 1);
+            suffix.resize(n + 1);
+            prefix.push_back(constant(T(1)));
+            for (std::size_t k = 0; k < n; k++) {
+                prefix.push_back(prefix.back() * factors[k]);
+            }
+            suffix[n] = constant(T(1));
+            for (std::size_t k = n; k > 0; k--) {
+                suffix[k - 1] = factors[k - 1] * suffix[k];
+            }
+        });
+        return prefix[i] * suffix[i + 1];
+    }
+
+private:
+    std::vector<DiffValue<T>> factors;
+    std::vector<DiffValue<T>> prefix;
+    std::vector<DiffValue<T>> suffix;
+    std::once_flag built;
+};
+
+template <typename It>
+using IteratorDiffValue = typename std::iterator_traits<It>::value_type;
+} // namespace impl
+
+/**
+ * The sum of a range of DiffValues, as a single node with an edge to each
+ * term. The sum of an empty range is 0.
+ */
+template <typename It>
+impl::IteratorDiffValue<It> sum(const It &begin, const It &end) {
+    using T = decltype(begin->value());
+    std::vector<DiffValue<T>> terms(begin, end);
+    return impl::sumNode(terms, static_cast<T>(0));
+}
+
+/**
+ * The product of a range of DiffValues, as a single node with an edge to
+ * each factor. The product of an empty range is 1.
+ */
+template <typename It>
+impl::IteratorDiffValue<It> product(const It &begin, const It &end) {
+    using T = decltype(begin->value());
+    std::vector<DiffValue<T>> factors(begin, end);
+    T value = 1;
+    for (const DiffValue<T> &factor : factors) {
+        value *= factor.value();
+    }
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(rhs),
-                       [lhs, rhs]() { return -lhs / (rhs * rhs); });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.reserve(factors.size());
+    // The numeric partial wrt a factor divides the product by it, unless
+    // that would divide by zero or by an overflowed product. Only then are
+    // the other factors multiplied, in O(n).
+    auto partial = impl::numericPartial<T>(
+        [](auto in, const auto &node, const auto &edge) {
+            auto factor = in(edge.to->value);
+            auto total = in(node.value);
+            if (factor != 0 && total != 0 && std::isfinite(total)) {
+                return total / factor;
+            }
+            auto others = in(1);
+            for (const auto &other : node.edges) {
+                if (&other != &edge) {
+                    others *= in(other.to->value);
+                }
+            }
+            return others;
+        });
+    for (const DiffValue<T> &factor : factors) {
+        edges.emplace_back(impl::getDiffValueNode(factor), nullptr, partial);
+    }
+    auto partials = std::make_shared<impl::ProductPartials<T>>(factors);
+    for (std::size_t i = 0; i < edges.size(); i++) {
+        edges[i].derivativeFn = [partials, i]() { return partials->get(i); };
+    }
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
-} // namespace leningrad
\ No newline at end of file
+/**
+ * Collects the terms of a sum, so that accumulating N terms creates one node
+ * with N edges instead of a chain of N additions.
+ */
+template <typename T> class Accumulator {
+public:
+    Accumulator() : terms(), offset(0) {}
+
+    Accumulator &operator+=(DiffValue<T> term) {
+        terms.push_back(std::move(term));
+        return *this;
+    }
+
+    Accumulator &operator+=(T term) {
+        offset += term;
+        return *this;
+    }
+
+    Accumulator &operator-=(DiffValue<T> term) {
+        terms.push_back(-std::move(term));
+        return *this;
+    }
+
+    Accumulator &operator-=(T term) {
+        offset -= term;
+        return *this;
+    }
+
+    std::size_t size() const { return terms.size(); }
+
+    bool empty() const { return terms.empty(); }
+
+    DiffValue<T> sum() const {
+        if (terms.size() == 1 && offset == 0) {
+            return terms.front();
+        }
+        return impl::sumNode(terms, offset);
+    }
+
+private:
+    std::vector<DiffValue<T>> terms;
+    T offset;
+};
+
+} // namespace leningrad
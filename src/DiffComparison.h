@@ -1,5 +1,11 @@
 #pragma once
 
+#include <cstddef>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#include "ComputationGraph.h"
 #include "DiffValue.h"
 
 namespace leningrad {
@@ -93,28 +99,92 @@ bool operator>(U lhs, const DiffValue<T> &rhs) {
     return !(lhs <= rhs);
 }
 
-template <typename T> DiffValue<T> max(const DiffValue<T> &x, const DiffValue<T> &y) {
-    return x > y ? x : y;
+namespace impl {
+// A node taking the value of whichever operand is selected, with an edge to
+// every DiffValue operand, so the graph has the same shape whichever one it
+// is. The adjoint only flows to the selected one.
+template <typename T>
+DiffValue<T> selectNode(T value, std::initializer_list<DiffValue<T>> operands,
+                        std::size_t selected) {
+    std::vector<Edge<T>> edges;
+    edges.reserve(operands.size());
+    std::size_t i = 0;
+    for (const DiffValue<T> &operand : operands) {
+        bool active = i == selected;
+        edges.emplace_back(getDiffValueNode(operand),
+                           [active]() { return active ? 1 : 0; },
+                           scalarPartial<T>(), active ? T(1) : T(0));
+        i++;
+    }
+    return createDiffValueFromNode(makeNode<T>(value, std::move(edges)));
+}
+} // namespace impl
+
+/**
+ * a if cond holds, otherwise b, as a single node with an edge to each.
+ */
+template <typename T>
+DiffValue<T> where(bool cond, const DiffValue<T> &a, const DiffValue<T> &b) {
+    return impl::selectNode(cond ? a.value() : b.value(), {a, b},
+                            cond ? 0 : 1);
+}
+
+template <typename T, typename U>
+DiffValue<T> where(bool cond, const DiffValue<T> &a, U b) {
+    return impl::selectNode(cond ? a.value() : static_cast<T>(b), {a},
+                            cond ? 0 : 1);
+}
+
+template <typename T, typename U>
+DiffValue<T> where(bool cond, U a, const DiffValue<T> &b) {
+    return impl::selectNode(cond ? static_cast<T>(a) : b.value(), {b},
+                            cond ? 1 : 0);
+}
+
+// On ties, min and max take y.
+template <typename T>
+DiffValue<T> max(const DiffValue<T> &x, const DiffValue<T> &y) {
+    return where(x > y, x, y);
 }
 
 template <typename T, typename U> DiffValue<T> max(const DiffValue<T> &x, U y) {
-    return x > y ? x : y;
+    return where(x > y, x, y);
 }
 
 template <typename T, typename U> DiffValue<T> max(U x, const DiffValue<T> &y) {
-    return x > y ? x : y;
+    return where(x > y, x, y);
 }
 
-template <typename T> DiffValue<T> min(const DiffValue<T> &x, const DiffValue<T> &y) {
-    return x < y ? x : y;
+template <typename T>
+DiffValue<T> min(const DiffValue<T> &x, const DiffValue<T> &y) {
+    return where(x < y, x, y);
 }
 
 template <typename T, typename U> DiffValue<T> min(const DiffValue<T> &x, U y) {
-    return x < y ? x : y;
+    return where(x < y, x, y);
 }
 
 template <typename T, typename U> DiffValue<T> min(U x, const DiffValue<T> &y) {
-    return x < y ? x : y;
+    return where(x < y, x, y);
+}
+
+/**
+ * x limited to [lo, hi], like std::clamp, as a single node.
+ */
+template <typename T>
+DiffValue<T> clamp(const DiffValue<T> &x, const DiffValue<T> &lo,
+                   const DiffValue<T> &hi) {
+    std::size_t selected = x < lo ? 1 : hi < x ? 2 : 0;
+    T value = selected == 1 ? lo.value() : selected == 2 ? hi.value()
+                                                         : x.value();
+    return impl::selectNode(value, {x, lo, hi}, selected);
+}
+
+template <typename T, typename U>
+DiffValue<T> clamp(const DiffValue<T> &x, U lo, U hi) {
+    T value = x < lo ? static_cast<T>(lo) : hi < x ? static_cast<T>(hi)
+                                                   : x.value();
+    return impl::selectNode(value, {x}, x < lo || hi < x ? 1 : 0);
 }
 
 } // namespace leningrad
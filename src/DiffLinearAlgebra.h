@@ -0,0 +1,444 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "ComputationGraph.h"
+#include "DiffArithmetic.h"
+#include "DiffOps.h"
+#include "DiffValue.h"
+#include "LinearAlgebra.h"
+
+// Dense matrices are passed as row-major std::vectors of n * n values.
+//
+// Each operation does its numeric work on plain values, and records its
+// result with analytic derivative rules, so the graph has O(n^2) nodes
+// instead of the O(n^3) elimination would create. Where every output
+// depends on every input, the rules go through intermediate nodes holding
+// the linearized residual of the operation (e.g. db - dA x for a solve).
+//
+// Numeric sweeps read the partials as plain numbers. Derivative graphs get
+// them as differentiable values instead, built from the inputs with these
+// same operations (e.g. the partials of a solve from inverse(a) and
+// solve(a, b)), so higher derivatives are exact too. The residual nodes'
+// partials depend on the whole matrix rather than on their own children,
+// so hessian() throws on solve() and inverse(); differentiate() them
+// instead.
+
+namespace leningrad {
+
+namespace impl {
+template <typename T>
+std::vector<T> valuesOf(const std::vector<DiffValue<T>> &xs) {
+    std::vector<T> values;
+    values.reserve(xs.size());
+    for (const DiffValue<T> &x : xs) {
+        values.push_back(x.value());
+    }
+    return values;
+}
+
+template <typename T>
+std::size_t squareSize(const std::vector<DiffValue<T>> &a) {
+    auto n =
+        static_cast<std::size_t>(std::sqrt(static_cast<double>(a.size())));
+    while (n * n < a.size()) {
+        n++;
+    }
+    if (n * n != a.size()) {
+        throw std::invalid_argument("Matrix must be n x n");
+    }
+    return n;
+}
+
+template <typename T>
+DiffValue<T> linearNode(T value, std::vector<Edge<T>> &&edges) {
+    return createDiffValueFromNode(makeNode<T>(value, std::move(edges)));
+}
+
+// A node whose partials are built from the whole matrix rather than from
+// its own children, e.g. the inverse behind a residual node
+template <typename T>
+DiffValue<T> nonlocalNode(T value, std::vector<Edge<T>> &&edges) {
+    auto node = makeNode<T>(value, std::move(edges));
+    node->set(Node<T>::Nonlocal);
+    return createDiffValueFromNode(std::move(node));
+}
+
+// An LU factorization, and the inverse it is only turned into the first time
+// a partial derivative needs it.
+template <typename T> class LazyInverse {
+public:
+    explicit LazyInverse(LUFactorization<T> lu) : lu(std::move(lu)) {}
+
+    const LUFactorization<T> &factorization() const { return lu; }
+
+    // (A^-1)_ij
+    T get(std::size_t i, std::size_t j) {
+        std::call_once(inverted, [this]() {
+            std::size_t n = lu.size();
+            inverse.assign(n * n, T(0));
+            std::vector<T> column(n);
+            for (std::size_t c = 0; c < n; c++) {
+                std::fill(column.begin(), column.end(), T(0));
+                column[c] = 1;
+                lu.solve(column.data());
+                for (std::size_t r = 0; r < n; r++) {
+                    inverse[r * n + c] = column[r];
+                }
+            }
+        });
+        return inverse[i * lu.size() + j];
+    }
+
+private:
+    LUFactorization<T> lu;
+    std::vector<T> inverse;
+    std::once_flag inverted;
+};
+
+// The differentiable partial derivatives of an operation, built the first
+// time a derivative graph needs one of them.
+template <typename T> class LazyPartials {
+public:
+    explicit LazyPartials(std::function<std::vector<DiffValue<T>>()> build)
+        : build(std::move(build)) {}
+
+    const DiffValue<T> &get(std::size_t i) {
+        std::call_once(built, [this]() {
+            partials = build();
+            build = nullptr;
+        });
+        return partials[i];
+    }
+
+private:
+    std::function<std::vector<DiffValue<T>>()> build;
+    std::vector<DiffValue<T>> partials;
+    std::once_flag built;
+};
+
+// The derivative rule of an edge whose numeric partial is its scalar times
+// (A^-1)_row,column, which is only computed the first time it is needed.
+template <typename T> struct InverseElementRule {
+    DiffValue<T> operator()() const { return partials->get(index); }
+
+    std::shared_ptr<LazyPartials<T>> partials;
+    std::size_t index;
+    std::shared_ptr<LazyInverse<T>> inverse;
+    std::size_t row;
+    std::size_t column;
+};
+
+template <typename T> const NumericPartial<T> *inverseElementPartial() {
+    // a numeric partial has no state of its own, so it reads the rule's
+    return numericPartial<T>([](auto in, const auto &, const auto &edge) {
+        const auto *rule =
+            edge.derivativeFn.template target<InverseElementRule<T>>();
+        return in(edge.scalar) *
+               in(rule->inverse->get(rule->row, rule->column));
+    });
+}
+
+template <typename T>
+Edge<T> inverseElementEdge(const DiffValue<T> &to, T scalar,
+                           InverseElementRule<T> rule) {
+    return Edge<T>(getDiffValueNode(to), std::move(rule),
+                   inverseElementPartial<T>(), scalar);
+}
+} // namespace impl
+
+template <typename T>
+std::vector<DiffValue<T>> inverse(const std::vector<DiffValue<T>> &a);
+
+/**
+ * The solution x of A x = b, with n = b.size().
+ *
+ * dx = A^-1 (db - dA x), so each x_i has an edge to each of n residual
+ * nodes, and each residual node has edges to one element of b and one row
+ * of A.
+ */
+template <typename T>
+std::vector<DiffValue<T>> solve(const std::vector<DiffValue<T>> &a,
+                                const std::vector<DiffValue<T>> &b) {
+    std::size_t n = b.size();
+    if (a.size() != n * n) {
+        throw std::invalid_argument("Matrix must be n x n, with n = b.size()");
+    }
+    auto state = std::make_shared<impl::LazyInverse<T>>(
+        impl::LUFactorization<T>(impl::valuesOf(a), n));
+    std::vector<T> x = impl::valuesOf(b);
+    state->factorization().solve(x.data());
+    // A^-1, followed by x
+    auto partials = std::make_shared<impl::LazyPartials<T>>([a, b]() {
+        std::vector<DiffValue<T>> result = inverse(a);
+        std::vector<DiffValue<T>> solution = solve(a, b);
+        result.insert(result.end(), solution.begin(), solution.end());
+        return result;
+    });
+
+    std::vector<DiffValue<T>> residuals;
+    residuals.reserve(n);
+    for (std::size_t j = 0; j < n; j++) {
+        std::vector<impl::Edge<T>> edges;
+        edges.reserve(n + 1);
+        edges.emplace_back(impl::getDiffValueNode(b[j]),
+                           []() { return DiffValue<T>(T(1)); },
+                           impl::scalarPartial<T>(), T(1));
+        for (std::size_t k = 0; k < n; k++) {
+            edges.emplace_back(
+                impl::getDiffValueNode(a[j * n + k]),
+                [partials, k, n]() { return -partials->get(n * n + k); },
+                impl::scalarPartial<T>(), -x[k]);
+        }
+        residuals.push_back(impl::nonlocalNode(T(0), std::move(edges)));
+    }
+
+    std::vector<DiffValue<T>> solution;
+    solution.reserve(n);
+    for (std::size_t i = 0; i < n; i++) {
+        std::vector<impl::Edge<T>> edges;
+        edges.reserve(n);
+        for (std::size_t j = 0; j < n; j++) {
+            edges.push_back(impl::inverseElementEdge(
+                residuals[j], T(1),
+                impl::InverseElementRule<T>{partials, i * n + j, state, i,
+                                            j}));
+        }
+        solution.push_back(impl::nonlocalNode(x[i], std::move(edges)));
+    }
+    return solution;
+}
+
+/**
+ * The inverse X of A.
+ *
+ * dX = -X dA X. Column l of X goes through n residual nodes -dA X_l, so the
+ * graph has 2 n^2 nodes with n edges each.
+ */
+template <typename T>
+std::vector<DiffValue<T>> inverse(const std::vector<DiffValue<T>> &a) {
+    std::size_t n = impl::squareSize(a);
+    auto state = std::make_shared<impl::LazyInverse<T>>(
+        impl::LUFactorization<T>(impl::valuesOf(a), n));
+    auto partials = std::make_shared<impl::LazyPartials<T>>(
+        [a]() { return inverse(a); });
+
+    // r_jl = -sum_k dA_jk X_kl
+    std::vector<DiffValue<T>> residuals;
+    residuals.reserve(n * n);
+    for (std::size_t j = 0; j < n; j++) {
+        for (std::size_t l = 0; l < n; l++) {
+            std::vector<impl::Edge<T>> edges;
+            edges.reserve(n);
+            for (std::size_t k = 0; k < n; k++) {
+                edges.emplace_back(
+                    impl::getDiffValueNode(a[j * n + k]),
+                    [partials, index = k * n + l]() {
+                        return -partials->get(index);
+                    },
+                    impl::scalarPartial<T>(), -state->get(k, l));
+            }
+            residuals.push_back(impl::nonlocalNode(T(0), std::move(edges)));
+        }
+    }
+
+    // dX_il = sum_j X_ij r_jl
+    std::vector<DiffValue<T>> result;
+    result.reserve(n * n);
+    for (std::size_t i = 0; i < n; i++) {
+        for (std::size_t l = 0; l < n; l++) {
+            std::vector<impl::Edge<T>> edges;
+            edges.reserve(n);
+            for (std::size_t j = 0; j < n; j++) {
+                edges.emplace_back(
+                    impl::getDiffValueNode(residuals[j * n + l]),
+                    [partials, index = i * n + j]() {
+                        return partials->get(index);
+                    },
+                    impl::scalarPartial<T>(), state->get(i, j));
+            }
+            result.push_back(
+                impl::nonlocalNode(state->get(i, l), std::move(edges)));
+        }
+    }
+    return result;
+}
+
+/**
+ * log |det A|, as a single node with an edge to each element of A.
+ */
+template <typename T>
+DiffValue<T> logAbsDeterminant(const std::vector<DiffValue<T>> &a) {
+    std::size_t n = impl::squareSize(a);
+    auto state = std::make_shared<impl::LazyInverse<T>>(
+        impl::LUFactorization<T>(impl::valuesOf(a), n));
+    // d log|det A| / dA_ij = (A^-1)_ji
+    auto partials = std::make_shared<impl::LazyPartials<T>>([a, n]() {
+        std::vector<DiffValue<T>> x = inverse(a);
+        std::vector<DiffValue<T>> result;
+        result.reserve(n * n);
+        for (std::size_t i = 0; i < n; i++) {
+            for (std::size_t j = 0; j < n; j++) {
+                result.push_back(x[j * n + i]);
+            }
+        }
+        return result;
+    });
+    std::vector<impl::Edge<T>> edges;
+    edges.reserve(n * n);
+    for (std::size_t i = 0; i < n; i++) {
+        for (std::size_t j = 0; j < n; j++) {
+            edges.push_back(impl::inverseElementEdge(
+                a[i * n + j], T(1),
+                impl::InverseElementRule<T>{partials, i * n + j, state, j,
+                                            i}));
+        }
+    }
+    return impl::linearNode(state->factorization().logAbsDeterminant(),
+                            std::move(edges));
+}
+
+/**
+ * det A, as a single node with an edge to each element of A. A must be
+ * nonsingular, since the derivatives go through its inverse.
+ */
+template <typename T>
+DiffValue<T> determinant(const std::vector<DiffValue<T>> &a) {
+    std::size_t n = impl::squareSize(a);
+    auto state = std::make_shared<impl::LazyInverse<T>>(
+        impl::LUFactorization<T>(impl::valuesOf(a), n));
+    const auto &lu = state->factorization();
+    T det = lu.determinantSign() * std::exp(lu.logAbsDeterminant());
+    // d det A / dA_ij = det A (A^-1)_ji
+    auto partials = std::make_shared<impl::LazyPartials<T>>([a, n]() {
+        std::vector<DiffValue<T>> x = inverse(a);
+        DiffValue<T> d = determinant(a);
+        std::vector<DiffValue<T>> result;
+        result.reserve(n * n);
+        for (std::size_t i = 0; i < n; i++) {
+            for (std::size_t j = 0; j < n; j++) {
+                result.push_back(d * x[j * n + i]);
+            }
+        }
+        return result;
+    });
+    std::vector<impl::Edge<T>> edges;
+    edges.reserve(n * n);
+    for (std::size_t i = 0; i < n; i++) {
+        for (std::size_t j = 0; j < n; j++) {
+            edges.push_back(impl::inverseElementEdge(
+                a[i * n + j], det,
+                impl::InverseElementRule<T>{partials, i * n + j, state, j,
+                                            i}));
+        }
+    }
+    return impl::linearNode(det, std::move(edges));
+}
+
+/**
+ * The Cholesky factor L of a symmetric positive definite A = L L^T, with
+ * zeros above the diagonal. Only the lower triangle of A is read, and it
+ * stands for both triangles, so each of its off-diagonal elements gets the
+ * derivatives of both.
+ *
+ * Each element of L is a single node with edges to the element of A and the
+ * earlier elements of L it is computed from, by the column-by-column
+ * algorithm, so the graph has n (n + 1) / 2 nodes instead of O(n^3).
+ */
+template <typename T>
+std::vector<DiffValue<T>> cholesky(const std::vector<DiffValue<T>> &a) {
+    std::size_t n = impl::squareSize(a);
+    std::vector<T> l =
+        impl::CholeskyFactorization<T>(impl::valuesOf(a), n).lower();
+    using Operands = std::shared_ptr<const std::vector<DiffValue<T>>>;
+
+    std::vector<DiffValue<T>> result(n * n, DiffValue<T>(T(0)));
+    for (std::size_t j = 0; j < n; j++) {
+        // L_jj = sqrt(A_jj - sum_k L_jk^2), with operands A_jj, L_j0, ...
+        T pivot = l[j * n + j];
+        auto operands = std::make_shared<std::vector<DiffValue<T>>>();
+        operands->push_back(a[j * n + j]);
+        operands->insert(operands->end(), result.begin() + j * n,
+                         result.begin() + j * n + j);
+        // L_jj, rebuilt from its operands, since a node can't refer to
+        // itself
+        auto rebuilt = std::make_shared<impl::LazyPartials<T>>(
+            [operands = Operands(operands)]() {
+                Accumulator<T> d;
+                d += (*operands)[0];
+                for (std::size_t k = 1; k < operands->size(); k++) {
+                    d -= square((*operands)[k]);
+                }
+                return std::vector<DiffValue<T>>{sqrt(d.sum())};
+            });
+        std::vector<impl::Edge<T>> edges;
+        edges.reserve(j + 1);
+        edges.emplace_back(
+            impl::getDiffValueNode(a[j * n + j]),
+            [rebuilt]() { return T(0.5) / rebuilt->get(0); },
+            impl::scalarPartial<T>(), T(0.5) / pivot);
+        for (std::size_t k = 0; k < j; k++) {
+            edges.emplace_back(
+                impl::getDiffValueNode(result[j * n + k]),
+                [rebuilt, ljk = result[j * n + k]]() {
+                    return -ljk / rebuilt->get(0);
+                },
+                impl::scalarPartial<T>(), -l[j * n + k] / pivot);
+        }
+        result[j * n + j] = impl::linearNode(pivot, std::move(edges));
+
+        // L_ij = (A_ij - sum_k L_ik L_jk) / L_jj
+        DiffValue<T> ljj = result[j * n + j];
+        for (std::size_t i = j + 1; i < n; i++) {
+            T value = l[i * n + j];
+            // A_ij, L_i0, L_j0, L_i1, L_j1, ...
+            auto products = std::make_shared<std::vector<DiffValue<T>>>();
+            products->reserve(2 * j + 1);
+            products->push_back(a[i * n + j]);
+            for (std::size_t k = 0; k < j; k++) {
+                products->push_back(result[i * n + k]);
+                products->push_back(result[j * n + k]);
+            }
+            edges.clear();
+            edges.reserve(2 * j + 2);
+            edges.emplace_back(
+                impl::getDiffValueNode(a[i * n + j]),
+                [ljj]() { return T(1) / ljj; }, impl::scalarPartial<T>(),
+                T(1) / pivot);
+            for (std::size_t k = 0; k < j; k++) {
+                edges.emplace_back(
+                    impl::getDiffValueNode(result[i * n + k]),
+                    [ljj, ljk = result[j * n + k]]() { return -ljk / ljj; },
+                    impl::scalarPartial<T>(), -l[j * n + k] / pivot);
+                edges.emplace_back(
+                    impl::getDiffValueNode(result[j * n + k]),
+                    [ljj, lik = result[i * n + k]]() { return -lik / ljj; },
+                    impl::scalarPartial<T>(), -l[i * n + k] / pivot);
+            }
+            // -L_ij / L_jj, with L_ij rebuilt from its operands
+            edges.emplace_back(
+                impl::getDiffValueNode(ljj),
+                [ljj, operands = Operands(products)]() {
+                    Accumulator<T> total;
+                    total += (*operands)[0];
+                    for (std::size_t k = 1; k < operands->size(); k += 2) {
+                        total -= (*operands)[k] * (*operands)[k + 1];
+                    }
+                    return -total.sum() / square(ljj);
+                },
+                impl::scalarPartial<T>(), -value / pivot);
+            result[i * n + j] = impl::linearNode(value, std::move(edges));
+        }
+    }
+    return result;
+}
+
+} // namespace leningrad
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <cmath>
 #include <memory>
 #include <vector>
@@ -14,10 +15,13 @@ template <typename T> DiffValue<T> abs(const DiffValue<T> &x) {
     T value = std::abs(x.value());
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(x),
-                       [x]() { return x >= 0 ? 1 : -1; });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return x >= 0 ? 1 : -1; },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return node.edges[0].to->value >= 0 ? in(1) : in(-1);
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T>
@@ -25,14 +29,22 @@ DiffValue<T> log(const DiffValue<T> &base, const DiffValue<T> &x) {
     T value = std::log(x.value()) / std::log(base.value());
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(base), [base, x]() {
-        return -log(base, x) / (base * log(base));
-    });
-    edges.emplace_back(impl::getDiffValueNode(x), [x, base]() {
-        return static_cast<T>(1) / (log(base) * x);
-    });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(base),
+        [base, x]() { return -log(base, x) / (base * log(base)); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto b = in(node.edges[0].to->value);
+            return -in(node.value) / (b * std::log(b));
+        }));
+    edges.emplace_back(
+        impl::getDiffValueNode(x),
+        [x, base]() { return static_cast<T>(1) / (log(base) * x); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return 1 / (std::log(in(node.edges[0].to->value)) *
+                        in(node.edges[1].to->value));
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T, typename U>
@@ -40,11 +52,15 @@ DiffValue<T> log(const DiffValue<T> &base, U x) {
     T value = std::log(x) / std::log(base.value());
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(base), [base, x]() {
-        return -log(base, x) / (base * log(base));
-    });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(base),
+        [base, x]() { return -log(base, x) / (base * log(base)); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto b = in(node.edges[0].to->value);
+            return -in(node.value) / (b * std::log(b));
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T, typename U>
@@ -52,15 +68,42 @@ DiffValue<T> log(U base, const DiffValue<T> &x) {
     T value = std::log(x.value()) / std::log(base);
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(x), [base, x]() {
-        return static_cast<T>(1) / (std::log(base) * x);
-    });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(x),
+        [base, x]() { return static_cast<T>(1) / (std::log(base) * x); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &edge) {
+            return 1 / (std::log(in(edge.scalar)) * in(node.edges[0].to->value));
+        }),
+        static_cast<T>(base));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T> DiffValue<T> log(const DiffValue<T> &x) {
-    return log(static_cast<T>(M_E), x);
+    T value = std::log(x.value());
+
+    std::vector<impl::Edge<T>> edges;
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return static_cast<T>(1) / x; },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return 1 / in(node.edges[0].to->value);
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
+}
+
+template <typename T> DiffValue<T> log1p(const DiffValue<T> &x) {
+    T value = std::log1p(x.value());
+
+    std::vector<impl::Edge<T>> edges;
+    edges.emplace_back(
+        impl::getDiffValueNode(x),
+        [x]() { return static_cast<T>(1) / (1 + x); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return 1 / (1 + in(node.edges[0].to->value));
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T> DiffValue<T> log10(const DiffValue<T> &x) {
@@ -75,86 +118,271 @@ template <typename T> DiffValue<T> sqrt(const DiffValue<T> &x) {
     T value = std::sqrt(x.value());
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(x),
-                       [x]() { return 1 / (2 * sqrt(x)); });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return 1 / (2 * sqrt(x)); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return 1 / (2 * std::sqrt(in(node.edges[0].to->value)));
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
+template <typename T, typename U>
+DiffValue<T> pow(const DiffValue<T> &lhs, U rhs);
+
 template <typename T>
 DiffValue<T> pow(const DiffValue<T> &lhs, const DiffValue<T> &rhs) {
+    if (impl::isConstant(rhs)) {
+        return pow(lhs, rhs.value());
+    }
     T value = rhs.value() == 0 ? 1 : std::pow(lhs.value(), rhs.value());
 
     std::vector<impl::Edge<T>> edges;
     if (rhs.value() == 0) {
-        edges.emplace_back(impl::getDiffValueNode(lhs), []() { return 0; });
+        edges.emplace_back(impl::getDiffValueNode(lhs), []() { return 0; },
+                           impl::scalarPartial<T>(), T(0));
     } else {
-        edges.emplace_back(impl::getDiffValueNode(lhs), [lhs, rhs]() {
-            return pow(lhs, rhs - static_cast<T>(1)) * rhs;
-        });
+        edges.emplace_back(
+            impl::getDiffValueNode(lhs),
+            [lhs, rhs]() { return pow(lhs, rhs - static_cast<T>(1)) * rhs; },
+            impl::numericPartial<T>(
+                [](auto in, const auto &node, const auto &) {
+                    auto r = in(node.edges[1].to->value);
+                    return std::pow(in(node.edges[0].to->value), r - 1) * r;
+                }));
     }
     if (lhs.value() == 0) {
-        edges.emplace_back(impl::getDiffValueNode(rhs), []() { return 0; });
+        edges.emplace_back(impl::getDiffValueNode(rhs), []() { return 0; },
+                           impl::scalarPartial<T>(), T(0));
     } else {
-        edges.emplace_back(impl::getDiffValueNode(rhs),
-                           [lhs, rhs]() { return log(lhs) * pow(lhs, rhs); });
+        edges.emplace_back(
+            impl::getDiffValueNode(rhs),
+            [lhs, rhs]() { return log(lhs) * pow(lhs, rhs); },
+            impl::numericPartial<T>(
+                [](auto in, const auto &node, const auto &) {
+                    auto l = in(node.edges[0].to->value);
+                    return std::log(l) *
+                           std::pow(l, in(node.edges[1].to->value));
+                }));
     }
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T, typename U>
 DiffValue<T> pow(const DiffValue<T> &lhs, U rhs) {
-    T value = rhs == 0 ? 1 : std::pow(lhs.value(), rhs);
+    T r = static_cast<T>(rhs);
+    T value = r == T(0) ? 1 : std::pow(lhs.value(), r);
+    if (r == T(0) || impl::isConstant(lhs)) {
+        return impl::constant(value);
+    } else if (r == T(1)) {
+        return lhs;
+    }
 
     std::vector<impl::Edge<T>> edges;
-    if (rhs == 0) {
-        edges.emplace_back(impl::getDiffValueNode(lhs), []() { return 0; });
-    } else {
-        edges.emplace_back(impl::getDiffValueNode(lhs),
-                           [lhs, rhs]() { return pow(lhs, rhs - 1) * rhs; });
-    }
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(lhs), [lhs, r]() { return pow(lhs, r - 1) * r; },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &edge) {
+            auto e = in(edge.scalar);
+            return std::pow(in(node.edges[0].to->value), e - 1) * e;
+        }),
+        r);
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T, typename U>
 DiffValue<T> pow(U lhs, const DiffValue<T> &rhs) {
-    T value = rhs.value() == 0 ? 1 : std::pow(lhs, rhs.value());
+    T l = static_cast<T>(lhs);
+    T value = rhs.value() == 0 ? 1 : std::pow(l, rhs.value());
+    if (impl::isConstant(rhs)) {
+        return impl::constant(value);
+    }
 
     std::vector<impl::Edge<T>> edges;
-    if (lhs == 0) {
-        edges.emplace_back(impl::getDiffValueNode(rhs), []() { return 0; });
+    if (l == T(0)) {
+        edges.emplace_back(impl::getDiffValueNode(rhs), []() { return 0; },
+                           impl::scalarPartial<T>(), T(0));
     } else {
-        edges.emplace_back(impl::getDiffValueNode(rhs), [lhs, rhs]() {
-            return std::log(lhs) * pow(lhs, rhs);
-        });
+        edges.emplace_back(
+            impl::getDiffValueNode(rhs),
+            [l, rhs]() { return std::log(l) * pow(l, rhs); },
+            impl::numericPartial<T>(
+                [](auto in, const auto &node, const auto &edge) {
+                    auto b = in(edge.scalar);
+                    return std::log(b) *
+                           std::pow(b, in(node.edges[0].to->value));
+                }),
+            l);
     }
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T> DiffValue<T> square(const DiffValue<T> &x) {
-    return pow(x, 2);
+    T value = x.value() * x.value();
+
+    std::vector<impl::Edge<T>> edges;
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return 2 * x; },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return 2 * in(node.edges[0].to->value);
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
+}
+
+// The fused functions below are single nodes whose derivatives reuse the
+// forward value. A node can't hold a reference to itself, so the derivative
+// rebuilds an equal node from the operands and the stored value instead of
+// recomputing it.
+namespace impl {
+template <typename T>
+DiffValue<T> hypotNode(const DiffValue<T> &x, const DiffValue<T> &y, T value) {
+    std::vector<Edge<T>> edges;
+    edges.emplace_back(
+        getDiffValueNode(x),
+        [x, y, value]() { return x / hypotNode(x, y, value); },
+        numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return in(node.edges[0].to->value) / in(node.value);
+        }));
+    edges.emplace_back(
+        getDiffValueNode(y),
+        [x, y, value]() { return y / hypotNode(x, y, value); },
+        numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return in(node.edges[1].to->value) / in(node.value);
+        }));
+    auto node = makeNode<T>(value, std::move(edges));
+    return createDiffValueFromNode(std::move(node));
 }
 
+template <typename T, typename U>
+DiffValue<T> hypotNode(const DiffValue<T> &x, U y, T value) {
+    std::vector<Edge<T>> edges;
+    edges.emplace_back(
+        getDiffValueNode(x),
+        [x, y, value]() { return x / hypotNode(x, y, value); },
+        numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return in(node.edges[0].to->value) / in(node.value);
+        }));
+    auto node = makeNode<T>(value, std::move(edges));
+    return createDiffValueFromNode(std::move(node));
+}
+
+template <typename T> DiffValue<T> expNode(const DiffValue<T> &x, T value) {
+    std::vector<Edge<T>> edges;
+    edges.emplace_back(
+        getDiffValueNode(x), [x, value]() { return expNode(x, value); },
+        numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return in(node.value);
+        }));
+    auto node = makeNode<T>(value, std::move(edges));
+    return createDiffValueFromNode(std::move(node));
+}
+} // namespace impl
+
 template <typename T>
 DiffValue<T> hypot(const DiffValue<T> &x, const DiffValue<T> &y) {
-    return sqrt(x * x + y * y);
+    return impl::hypotNode(x, y, std::hypot(x.value(), y.value()));
 }
 
 template <typename T, typename U>
 DiffValue<T> hypot(const DiffValue<T> &x, U y) {
-    return sqrt(x * x + y * y);
+    return impl::hypotNode(x, y, static_cast<T>(std::hypot(x.value(), y)));
 }
 
 template <typename T, typename U>
 DiffValue<T> hypot(U x, const DiffValue<T> &y) {
-    return sqrt(x * x + y * y);
+    return hypot(y, x);
 }
 
 template <typename T> DiffValue<T> exp(const DiffValue<T> &x) {
-    return pow(static_cast<T>(M_E), x);
+    return impl::expNode(x, std::exp(x.value()));
+}
+
+template <typename T> DiffValue<T> expm1(const DiffValue<T> &x) {
+    T value = std::expm1(x.value());
+
+    std::vector<impl::Edge<T>> edges;
+    edges.emplace_back(
+        impl::getDiffValueNode(x),
+        [x, value]() { return impl::expNode(x, value + 1); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return in(node.value) + 1;
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
+}
+
+namespace impl {
+template <typename T>
+DiffValue<T> sigmoidNode(const DiffValue<T> &x, T value) {
+    std::vector<Edge<T>> edges;
+    edges.emplace_back(
+        getDiffValueNode(x),
+        [x, value]() {
+            DiffValue<T> s = sigmoidNode(x, value);
+            return s * (1 - s);
+        },
+        numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto s = in(node.value);
+            return s * (1 - s);
+        }));
+    auto node = makeNode<T>(value, std::move(edges));
+    return createDiffValueFromNode(std::move(node));
+}
+} // namespace impl
+
+/**
+ * 1 / (1 + exp(-x)), as a single node.
+ */
+template <typename T> DiffValue<T> sigmoid(const DiffValue<T> &x) {
+    // written so that exp never overflows
+    T e = std::exp(-std::abs(x.value()));
+    T value = x.value() >= 0 ? 1 / (1 + e) : e / (1 + e);
+    return impl::sigmoidNode(x, value);
+}
+
+/**
+ * log(1 + exp(x)), as a single node that doesn't overflow for large x.
+ */
+template <typename T> DiffValue<T> softplus(const DiffValue<T> &x) {
+    T value = std::max(x.value(), static_cast<T>(0)) +
+              std::log1p(std::exp(-std::abs(x.value())));
+
+    std::vector<impl::Edge<T>> edges;
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return sigmoid(x); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return 1 / (1 + std::exp(-in(node.edges[0].to->value)));
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
+}
+
+/**
+ * x * y + z, as a single node, rounded once like std::fma.
+ */
+template <typename T>
+DiffValue<T> fma(const DiffValue<T> &x, const DiffValue<T> &y,
+                 const DiffValue<T> &z) {
+    T value = std::fma(x.value(), y.value(), z.value());
+
+    std::vector<impl::Edge<T>> edges;
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [y]() { return y; },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return in(node.edges[1].to->value);
+        }));
+    edges.emplace_back(
+        impl::getDiffValueNode(y), [x]() { return x; },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return in(node.edges[0].to->value);
+        }));
+    edges.emplace_back(impl::getDiffValueNode(z), []() { return 1; },
+                       impl::scalarPartial<T>(), T(1));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T> DiffValue<T> cos(const DiffValue<T> &x);
@@ -163,90 +391,199 @@ template <typename T> DiffValue<T> sin(const DiffValue<T> &x) {
     T value = std::sin(x.value());
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(x), [x]() { return cos(x); });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return cos(x); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return std::cos(in(node.edges[0].to->value));
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T> DiffValue<T> cos(const DiffValue<T> &x) {
     T value = std::cos(x.value());
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(x), [x]() { return -sin(x); });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
-}
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return -sin(x); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return -std::sin(in(node.edges[0].to->value));
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
+}
+
+template <typename T> DiffValue<T> tan(const DiffValue<T> &x);
+
+template <typename T> DiffValue<T> cot(const DiffValue<T> &x);
+
+namespace impl {
+template <typename T> DiffValue<T> secNode(const DiffValue<T> &x, T value) {
+    std::vector<Edge<T>> edges;
+    edges.emplace_back(
+        getDiffValueNode(x), [x, value]() { return secNode(x, value) * tan(x); },
+        numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return in(node.value) * std::tan(in(node.edges[0].to->value));
+        }));
+    auto node = makeNode<T>(value, std::move(edges));
+    return createDiffValueFromNode(std::move(node));
+}
+
+template <typename T> DiffValue<T> cscNode(const DiffValue<T> &x, T value) {
+    std::vector<Edge<T>> edges;
+    edges.emplace_back(
+        getDiffValueNode(x),
+        [x, value]() { return -cscNode(x, value) * cot(x); },
+        numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return -in(node.value) / std::tan(in(node.edges[0].to->value));
+        }));
+    auto node = makeNode<T>(value, std::move(edges));
+    return createDiffValueFromNode(std::move(node));
+}
+} // namespace impl
 
 template <typename T> DiffValue<T> sec(const DiffValue<T> &x) {
-    return static_cast<T>(1) / cos(x);
+    return impl::secNode(x, 1 / std::cos(x.value()));
 }
 
 template <typename T> DiffValue<T> csc(const DiffValue<T> &x) {
-    return static_cast<T>(1) / sin(x);
+    return impl::cscNode(x, 1 / std::sin(x.value()));
 }
 
 template <typename T> DiffValue<T> tan(const DiffValue<T> &x) {
     T value = std::tan(x.value());
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(x),
-                       [x]() { return pow(sec(x), 2); });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return square(sec(x)); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto c = std::cos(in(node.edges[0].to->value));
+            return 1 / (c * c);
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T> DiffValue<T> cot(const DiffValue<T> &x) {
-    return static_cast<T>(1) / tan(x);
+    T value = 1 / std::tan(x.value());
+
+    std::vector<impl::Edge<T>> edges;
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return -square(csc(x)); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto s = std::sin(in(node.edges[0].to->value));
+            return -1 / (s * s);
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T> DiffValue<T> acos(const DiffValue<T> &x) {
     T value = std::acos(x.value());
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(x),
-                       [x]() { return -1 / sqrt(1 - x * x); });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return -1 / sqrt(1 - x * x); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto v = in(node.edges[0].to->value);
+            return -1 / std::sqrt(1 - v * v);
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T> DiffValue<T> asin(const DiffValue<T> &x) {
     T value = std::asin(x.value());
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(x),
-                       [x]() { return 1 / sqrt(1 - x * x); });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return 1 / sqrt(1 - x * x); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto v = in(node.edges[0].to->value);
+            return 1 / std::sqrt(1 - v * v);
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T> DiffValue<T> atan(const DiffValue<T> &x) {
     T value = std::atan(x.value());
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(x),
-                       [x]() { return 1 / (1 + x * x); });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
-}
-
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return 1 / (1 + x * x); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto v = in(node.edges[0].to->value);
+            return 1 / (1 + v * v);
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
+}
+
+/**
+ * The angle of (x, y), as a single node with analytic partials in both
+ * arguments. At the origin, where std::atan2 is not differentiable, the
+ * partials are NaN.
+ */
 template <typename T>
 DiffValue<T> atan2(const DiffValue<T> &y, const DiffValue<T> &x) {
-    if (x > 0) {
-        return atan(y / x);
-    }
-    if (x < 0 && y >= 0) {
-        return atan(y / x) + static_cast<T>(M_PI);
-    }
-    if (x < 0 && y < 0) {
-        return atan(y / x) - static_cast<T>(M_PI);
-    }
-    if (x == 0 && y > 0) {
-        return M_PI / 2;
-    }
-    if (x == 0 && y < 0) {
-        return -M_PI / 2;
-    }
-    return NAN;
+    T value = std::atan2(y.value(), x.value());
+
+    std::vector<impl::Edge<T>> edges;
+    edges.emplace_back(
+        impl::getDiffValueNode(y), [y, x]() { return x / (x * x + y * y); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto yw = in(node.edges[0].to->value);
+            auto xw = in(node.edges[1].to->value);
+            return xw / (xw * xw + yw * yw);
+        }));
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [y, x]() { return -y / (x * x + y * y); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto yw = in(node.edges[0].to->value);
+            auto xw = in(node.edges[1].to->value);
+            return -yw / (xw * xw + yw * yw);
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
+}
+
+template <typename T, typename U>
+DiffValue<T> atan2(const DiffValue<T> &y, U x) {
+    T xv = static_cast<T>(x);
+    T value = std::atan2(y.value(), xv);
+
+    std::vector<impl::Edge<T>> edges;
+    edges.emplace_back(
+        impl::getDiffValueNode(y),
+        [y, xv]() { return xv / (xv * xv + y * y); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &edge) {
+            auto yw = in(node.edges[0].to->value);
+            auto xw = in(edge.scalar);
+            return xw / (xw * xw + yw * yw);
+        }),
+        xv);
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
+}
+
+template <typename T, typename U>
+DiffValue<T> atan2(U y, const DiffValue<T> &x) {
+    T yv = static_cast<T>(y);
+    T value = std::atan2(yv, x.value());
+
+    std::vector<impl::Edge<T>> edges;
+    edges.emplace_back(
+        impl::getDiffValueNode(x),
+        [yv, x]() { return -yv / (x * x + yv * yv); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &edge) {
+            auto yw = in(edge.scalar);
+            auto xw = in(node.edges[0].to->value);
+            return -yw / (xw * xw + yw * yw);
+        }),
+        yv);
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T> DiffValue<T> sinh(const DiffValue<T> &x);
@@ -255,72 +592,174 @@ template <typename T> DiffValue<T> cosh(const DiffValue<T> &x) {
     T value = (std::exp(x.value()) + std::exp(-x.value())) / static_cast<T>(2);
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(x), [x]() { return sinh(x); });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return sinh(x); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return std::sinh(in(node.edges[0].to->value));
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T> DiffValue<T> sinh(const DiffValue<T> &x) {
     T value = (std::exp(x.value()) - std::exp(-x.value())) / static_cast<T>(2);
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(x), [x]() { return cosh(x); });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
-}
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return cosh(x); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            return std::cosh(in(node.edges[0].to->value));
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
+}
+
+namespace impl {
+template <typename T> DiffValue<T> tanhNode(const DiffValue<T> &x, T value) {
+    std::vector<Edge<T>> edges;
+    edges.emplace_back(
+        getDiffValueNode(x),
+        [x, value]() { return 1 - square(tanhNode(x, value)); },
+        numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto t = in(node.value);
+            return 1 - t * t;
+        }));
+    auto node = makeNode<T>(value, std::move(edges));
+    return createDiffValueFromNode(std::move(node));
+}
+} // namespace impl
 
 template <typename T> DiffValue<T> tanh(const DiffValue<T> &x) {
-    return sinh(x) / cosh(x);
+    return impl::tanhNode(x, std::tanh(x.value()));
 }
 
 template <typename T> DiffValue<T> acosh(const DiffValue<T> &x) {
     T value = std::acosh(x.value());
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(x),
-                       [x]() { return 1 / sqrt(x * x - 1); });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return 1 / sqrt(x * x - 1); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto v = in(node.edges[0].to->value);
+            return 1 / std::sqrt(v * v - 1);
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T> DiffValue<T> asinh(const DiffValue<T> &x) {
     T value = std::asinh(x.value());
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(x),
-                       [x]() { return 1 / sqrt(x * x + 1); });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return 1 / sqrt(x * x + 1); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto v = in(node.edges[0].to->value);
+            return 1 / std::sqrt(v * v + 1);
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T> DiffValue<T> atanh(const DiffValue<T> &x) {
     T value = std::atanh(x.value());
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(x),
-                       [x]() { return 1 / (1 - x * x); });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(x), [x]() { return 1 / (1 - x * x); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto v = in(node.edges[0].to->value);
+            return 1 / (1 - v * v);
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T> DiffValue<T> erf(const DiffValue<T> &x) {
     T value = std::erf(x.value());
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(x),
-                       [x]() { return 2 * exp(-x * x) / std::sqrt(M_PI); });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    edges.emplace_back(
+        impl::getDiffValueNode(x),
+        [x]() { return 2 * exp(-x * x) / std::sqrt(M_PI); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto v = in(node.edges[0].to->value);
+            return 2 * std::exp(-v * v) / std::sqrt(in(M_PI));
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T> DiffValue<T> erfc(const DiffValue<T> &x) {
     T value = std::erfc(x.value());
 
+    std::vector<impl::Edge<T>> edges;
+    edges.emplace_back(
+        impl::getDiffValueNode(x),
+        [x]() { return -2 * exp(-x * x) / std::sqrt(M_PI); },
+        impl::numericPartial<T>([](auto in, const auto &node, const auto &) {
+            auto v = in(node.edges[0].to->value);
+            return -2 * std::exp(-v * v) / std::sqrt(in(M_PI));
+        }));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
+}
+
+/**
+ * max(x, 0), as a single node.
+ */
+template <typename T> DiffValue<T> relu(const DiffValue<T> &x) {
+    bool active = x.value() > 0;
+
     std::vector<impl::Edge<T>> edges;
     edges.emplace_back(impl::getDiffValueNode(x),
-                       [x]() { return -2 * exp(-x * x) / std::sqrt(M_PI); });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+                       [active]() { return active ? 1 : 0; },
+                       impl::scalarPartial<T>(), active ? T(1) : T(0));
+    auto node = impl::makeNode<T>(active ? x.value() : T(0), std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
+}
+
+/**
+ * The remainder of x / y rounded towards zero, like std::fmod, as a single
+ * node: x - trunc(x / y) * y, with the quotient held constant.
+ */
+template <typename T>
+DiffValue<T> fmod(const DiffValue<T> &x, const DiffValue<T> &y) {
+    T value = std::fmod(x.value(), y.value());
+    T quotient = std::trunc(x.value() / y.value());
+
+    std::vector<impl::Edge<T>> edges;
+    edges.emplace_back(impl::getDiffValueNode(x), []() { return 1; },
+                       impl::scalarPartial<T>(), T(1));
+    edges.emplace_back(impl::getDiffValueNode(y),
+                       [quotient]() { return DiffValue<T>(-quotient); },
+                       impl::scalarPartial<T>(), -quotient);
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
+}
+
+template <typename T, typename U>
+DiffValue<T> fmod(const DiffValue<T> &x, U y) {
+    T value = std::fmod(x.value(), static_cast<T>(y));
+
+    std::vector<impl::Edge<T>> edges;
+    edges.emplace_back(impl::getDiffValueNode(x), []() { return 1; },
+                       impl::scalarPartial<T>(), T(1));
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
+}
+
+template <typename T, typename U>
+DiffValue<T> fmod(U x, const DiffValue<T> &y) {
+    T value = std::fmod(static_cast<T>(x), y.value());
+    T quotient = std::trunc(static_cast<T>(x) / y.value());
+
+    std::vector<impl::Edge<T>> edges;
+    edges.emplace_back(impl::getDiffValueNode(y),
+                       [quotient]() { return DiffValue<T>(-quotient); },
+                       impl::scalarPartial<T>(), -quotient);
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T>
@@ -328,11 +767,12 @@ DiffValue<T> copysign(const DiffValue<T> &mag, const DiffValue<T> &sgn) {
     T value = std::copysign(mag.value(), sgn.value());
 
     std::vector<impl::Edge<T>> edges;
-    edges.emplace_back(impl::getDiffValueNode(mag), [sgn, mag]() {
-        return std::signbit(sgn.value()) == std::signbit(mag.value()) ? 1 : -1;
-    });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+    T partial = std::signbit(sgn.value()) == std::signbit(mag.value()) ? 1 : -1;
+    edges.emplace_back(impl::getDiffValueNode(mag),
+                       [partial]() { return DiffValue<T>(partial); },
+                       impl::scalarPartial<T>(), partial);
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 template <typename T, typename U>
@@ -340,10 +780,12 @@ DiffValue<T> copysign(const DiffValue<T> &mag, U sgn) {
     T value = std::copysign(mag.value(), sgn);
 
     std::vector<impl::Edge<T>> edges;
+    T partial = std::signbit(sgn) ? -1 : 1;
     edges.emplace_back(impl::getDiffValueNode(mag),
-                       [sgn]() { return std::signbit(sgn) ? -1 : 1; });
-    auto node = std::make_shared<impl::Node<T>>(value, std::move(edges));
-    return impl::createDiffValueFromNode(node);
+                       [partial]() { return DiffValue<T>(partial); },
+                       impl::scalarPartial<T>(), partial);
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
 }
 
 } // namespace leningrad
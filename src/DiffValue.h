@@ -3,76 +3,78 @@
 #include <memory>
 #include <string>
 #include <type_traits>
+#include <utility>
 
 #include "ComputationGraph.h"
 
 namespace leningrad {
 
 namespace impl {
-template <typename T> std::shared_ptr<impl::Node<T>> getDiffValueNode(const DiffValue<T> &value);
-template <typename T> DiffValue<T> createDiffValueFromNode(const std::shared_ptr<Node<T>> &node);
+template <typename T> const NodePtr<T> &getDiffValueNode(const DiffValue<T> &value);
+template <typename T> NodePtr<T> releaseDiffValueNode(DiffValue<T> &&value);
+template <typename T> DiffValue<T> createDiffValueFromNode(NodePtr<T> node);
 } // namespace impl
 
 template <typename T> class DiffValue {
     static_assert(std::is_floating_point<T>::value);
 
 public:
-    DiffValue() : node(std::make_shared<impl::Node<T>>()) {}
+    DiffValue() : node(impl::makeNode<T>()) {}
 
     DiffValue(T value) // NOLINT(google-explicit-constructor)
-        : node(std::make_shared<impl::Node<T>>(value)) {}
+        : node(impl::makeNode<T>(value)) {}
 
     T value() const { return node->value; }
 
-    DiffValue &operator+=(const DiffValue &rhs) {
-        *this = *this + rhs;
+    DiffValue &operator+=(DiffValue rhs) {
+        *this = std::move(*this) + std::move(rhs);
         return *this;
     }
 
     DiffValue &operator+=(T rhs) {
-        *this = *this + rhs;
+        *this = std::move(*this) + rhs;
         return *this;
     }
 
-    DiffValue &operator-=(const DiffValue &rhs) {
-        *this = *this - rhs;
+    DiffValue &operator-=(DiffValue rhs) {
+        *this = std::move(*this) - std::move(rhs);
         return *this;
     }
 
     DiffValue &operator-=(T rhs) {
-        *this = *this - rhs;
+        *this = std::move(*this) - rhs;
         return *this;
     }
 
-    DiffValue &operator*=(const DiffValue &rhs) {
-        *this = *this * rhs;
+    DiffValue &operator*=(DiffValue rhs) {
+        *this = std::move(*this) * std::move(rhs);
         return *this;
     }
 
     DiffValue &operator*=(T rhs) {
-        *this = *this * rhs;
+        *this = std::move(*this) * rhs;
         return *this;
     }
 
-    DiffValue &operator/=(const DiffValue &rhs) {
-        *this = *this / rhs;
+    DiffValue &operator/=(DiffValue rhs) {
+        *this = std::move(*this) / std::move(rhs);
         return *this;
     }
 
     DiffValue &operator/=(T rhs) {
-        *this = *this / rhs;
+        *this = std::move(*this) / rhs;
         return *this;
     }
 
 private:
-    explicit DiffValue(const std::shared_ptr<impl::Node<T>> &node)
-        : node(node) {}
-    std::shared_ptr<impl::Node<T>> node;
+    explicit DiffValue(impl::NodePtr<T> node) : node(std::move(node)) {}
+    impl::NodePtr<T> node;
 
-    friend std::shared_ptr<impl::Node<T>> impl::getDiffValueNode<T>(const DiffValue<T> &value);
+    friend const impl::NodePtr<T> &impl::getDiffValueNode<T>(const DiffValue<T> &value);
 
-    friend DiffValue
-    impl::createDiffValueFromNode<T>(const std::shared_ptr<impl::Node<T>> &node);
+    friend impl::NodePtr<T> impl::releaseDiffValueNode<T>(DiffValue<T> &&value);
+
+    friend DiffValue impl::createDiffValueFromNode<T>(impl::NodePtr<T> node);
 };
 
 template <typename T> std::ostream &operator<<(std::ostream &ostream, const DiffValue<T> &value) {
@@ -80,13 +82,16 @@ template <typename T> std::ostream &operator<<(std::ostream &ostream, const Diff
 }
 
 namespace impl {
-template <typename T> std::shared_ptr<Node<T>> getDiffValueNode(const DiffValue<T> &value) {
+template <typename T> const NodePtr<T> &getDiffValueNode(const DiffValue<T> &value) {
     return value.node;
 }
 
-template <typename T>
-DiffValue<T> createDiffValueFromNode(const std::shared_ptr<Node<T>> &node) {
-    return DiffValue<T>(node);
+template <typename T> NodePtr<T> releaseDiffValueNode(DiffValue<T> &&value) {
+    return std::move(value.node);
+}
+
+template <typename T> DiffValue<T> createDiffValueFromNode(NodePtr<T> node) {
+    return DiffValue<T>(std::move(node));
 }
 } // namespace impl
 } // namespace leningrad
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ComputationGraph.h"
+#include "Derivative.h"
+#include "DiffArithmetic.h"
+#include "DiffComparison.h"
+#include "DiffOps.h"
+#include "DiffValue.h"
+
+// With LENINGRAD_COMPILED defined, the templates every translation unit
+// would otherwise instantiate for double and float are declared extern
+// here, and instantiated once in the leningrad_compiled library
+// (src/Instantiations.cpp, which defines LENINGRAD_INSTANTIATE instead).
+// Scalar overloads are covered for scalars of the value type and int.
+
+#if defined(LENINGRAD_INSTANTIATE)
+#define LENINGRAD_TEMPLATE template
+#elif defined(LENINGRAD_COMPILED)
+#define LENINGRAD_TEMPLATE extern template
+#endif
+
+#ifdef LENINGRAD_TEMPLATE
+
+#if defined(LENINGRAD_COMPILED) && defined(LENINGRAD_SINGLE_THREADED)
+#error "leningrad_compiled is built without LENINGRAD_SINGLE_THREADED"
+#endif
+
+#define LENINGRAD_UNARY_OPS(T)                                                 \
+    LENINGRAD_TEMPLATE DiffValue<T> abs(const DiffValue<T> &);                 \
+    LENINGRAD_TEMPLATE DiffValue<T> log(const DiffValue<T> &);                 \
+    LENINGRAD_TEMPLATE DiffValue<T> log1p(const DiffValue<T> &);               \
+    LENINGRAD_TEMPLATE DiffValue<T> log10(const DiffValue<T> &);               \
+    LENINGRAD_TEMPLATE DiffValue<T> log2(const DiffValue<T> &);                \
+    LENINGRAD_TEMPLATE DiffValue<T> sqrt(const DiffValue<T> &);                \
+    LENINGRAD_TEMPLATE DiffValue<T> square(const DiffValue<T> &);              \
+    LENINGRAD_TEMPLATE DiffValue<T> exp(const DiffValue<T> &);                 \
+    LENINGRAD_TEMPLATE DiffValue<T> expm1(const DiffValue<T> &);               \
+    LENINGRAD_TEMPLATE DiffValue<T> sigmoid(const DiffValue<T> &);             \
+    LENINGRAD_TEMPLATE DiffValue<T> softplus(const DiffValue<T> &);            \
+    LENINGRAD_TEMPLATE DiffValue<T> sin(const DiffValue<T> &);                 \
+    LENINGRAD_TEMPLATE DiffValue<T> cos(const DiffValue<T> &);                 \
+    LENINGRAD_TEMPLATE DiffValue<T> tan(const DiffValue<T> &);                 \
+    LENINGRAD_TEMPLATE DiffValue<T> cot(const DiffValue<T> &);                 \
+    LENINGRAD_TEMPLATE DiffValue<T> sec(const DiffValue<T> &);                 \
+    LENINGRAD_TEMPLATE DiffValue<T> csc(const DiffValue<T> &);                 \
+    LENINGRAD_TEMPLATE DiffValue<T> acos(const DiffValue<T> &);                \
+    LENINGRAD_TEMPLATE DiffValue<T> asin(const DiffValue<T> &);                \
+    LENINGRAD_TEMPLATE DiffValue<T> atan(const DiffValue<T> &);                \
+    LENINGRAD_TEMPLATE DiffValue<T> sinh(const DiffValue<T> &);                \
+    LENINGRAD_TEMPLATE DiffValue<T> cosh(const DiffValue<T> &);                \
+    LENINGRAD_TEMPLATE DiffValue<T> tanh(const DiffValue<T> &);                \
+    LENINGRAD_TEMPLATE DiffValue<T> acosh(const DiffValue<T> &);               \
+    LENINGRAD_TEMPLATE DiffValue<T> asinh(const DiffValue<T> &);               \
+    LENINGRAD_TEMPLATE DiffValue<T> atanh(const DiffValue<T> &);               \
+    LENINGRAD_TEMPLATE DiffValue<T> erf(const DiffValue<T> &);                 \
+    LENINGRAD_TEMPLATE DiffValue<T> erfc(const DiffValue<T> &);                \
+    LENINGRAD_TEMPLATE DiffValue<T> relu(const DiffValue<T> &);                \
+    LENINGRAD_TEMPLATE DiffValue<T> operator-(DiffValue<T>);
+
+#define LENINGRAD_BINARY_OPS(T)                                                \
+    LENINGRAD_TEMPLATE DiffValue<T> operator+(DiffValue<T>, DiffValue<T>);     \
+    LENINGRAD_TEMPLATE DiffValue<T> operator-(DiffValue<T>, DiffValue<T>);     \
+    LENINGRAD_TEMPLATE DiffValue<T> operator*(DiffValue<T>, DiffValue<T>);     \
+    LENINGRAD_TEMPLATE DiffValue<T> operator/(DiffValue<T>, DiffValue<T>);     \
+    LENINGRAD_TEMPLATE DiffValue<T> log(const DiffValue<T> &,                  \
+                                        const DiffValue<T> &);                 \
+    LENINGRAD_TEMPLATE DiffValue<T> pow(const DiffValue<T> &,                  \
+                                        const DiffValue<T> &);                 \
+    LENINGRAD_TEMPLATE DiffValue<T> hypot(const DiffValue<T> &,                \
+                                          const DiffValue<T> &);               \
+    LENINGRAD_TEMPLATE DiffValue<T> atan2(const DiffValue<T> &,                \
+                                          const DiffValue<T> &);               \
+    LENINGRAD_TEMPLATE DiffValue<T> copysign(const DiffValue<T> &,             \
+                                             const DiffValue<T> &);            \
+    LENINGRAD_TEMPLATE DiffValue<T> fmod(const DiffValue<T> &,                 \
+                                         const DiffValue<T> &);                \
+    LENINGRAD_TEMPLATE DiffValue<T> min(const DiffValue<T> &,                  \
+                                        const DiffValue<T> &);                 \
+    LENINGRAD_TEMPLATE DiffValue<T> max(const DiffValue<T> &,                  \
+                                        const DiffValue<T> &);                 \
+    LENINGRAD_TEMPLATE DiffValue<T> where(bool, const DiffValue<T> &,          \
+                                          const DiffValue<T> &);               \
+    LENINGRAD_TEMPLATE DiffValue<T> clamp(const DiffValue<T> &,                \
+                                          const DiffValue<T> &,                \
+                                          const DiffValue<T> &);               \
+    LENINGRAD_TEMPLATE DiffValue<T> fma(const DiffValue<T> &,                  \
+                                        const DiffValue<T> &,                  \
+                                        const DiffValue<T> &);
+
+#define LENINGRAD_SCALAR_OPS(T, U)                                             \
+    LENINGRAD_TEMPLATE DiffValue<T> operator+(DiffValue<T>, U);                \
+    LENINGRAD_TEMPLATE DiffValue<T> operator+(U, DiffValue<T>);                \
+    LENINGRAD_TEMPLATE DiffValue<T> operator-(DiffValue<T>, U);                \
+    LENINGRAD_TEMPLATE DiffValue<T> operator-(U, DiffValue<T>);                \
+    LENINGRAD_TEMPLATE DiffValue<T> operator*(DiffValue<T>, U);                \
+    LENINGRAD_TEMPLATE DiffValue<T> operator*(U, DiffValue<T>);                \
+    LENINGRAD_TEMPLATE DiffValue<T> operator/(DiffValue<T>, U);                \
+    LENINGRAD_TEMPLATE DiffValue<T> operator/(U, DiffValue<T>);                \
+    LENINGRAD_TEMPLATE DiffValue<T> pow(const DiffValue<T> &, U);              \
+    LENINGRAD_TEMPLATE DiffValue<T> pow(U, const DiffValue<T> &);
+
+#define LENINGRAD_DERIVATIVES(T)                                               \
+    LENINGRAD_TEMPLATE class DerivativeResult<T>;                              \
+    LENINGRAD_TEMPLATE class GradientResult<T, AccumulatorTypeT<T>>;           \
+    LENINGRAD_TEMPLATE DerivativeResult<T> differentiate(const DiffValue<T> &, \
+                                                         GraphRetention);      \
+    LENINGRAD_TEMPLATE DiffValue<T> differentiate(                             \
+        const DiffValue<T> &, const DiffValue<T> &, unsigned int);             \
+    LENINGRAD_TEMPLATE class DerivativeCache<T>;                               \
+    LENINGRAD_TEMPLATE DerivativeResult<T> differentiate(                      \
+        const DiffValue<T> &, DerivativeCache<T> &);                           \
+    LENINGRAD_TEMPLATE DiffValue<T> sum(                                       \
+        const std::vector<DiffValue<T>>::iterator &,                           \
+        const std::vector<DiffValue<T>>::iterator &);                          \
+    LENINGRAD_TEMPLATE DiffValue<T> sum(                                       \
+        const std::vector<DiffValue<T>>::const_iterator &,                     \
+        const std::vector<DiffValue<T>>::const_iterator &);                    \
+    LENINGRAD_TEMPLATE DiffValue<T> product(                                   \
+        const std::vector<DiffValue<T>>::iterator &,                           \
+        const std::vector<DiffValue<T>>::iterator &);                          \
+    LENINGRAD_TEMPLATE DiffValue<T> product(                                   \
+        const std::vector<DiffValue<T>>::const_iterator &,                     \
+        const std::vector<DiffValue<T>>::const_iterator &);                    \
+    LENINGRAD_TEMPLATE class Accumulator<T>;
+
+#define LENINGRAD_IMPL(T)                                                      \
+    LENINGRAD_TEMPLATE std::vector<NodePtr<T>> topologicalOrder(               \
+        const NodePtr<T> &,                                                    \
+        std::unordered_map<const Node<T> *, std::size_t> *,                    \
+        const std::unordered_set<const Node<T> *> *);                          \
+    LENINGRAD_TEMPLATE std::vector<AccumulatorTypeT<T>>                        \
+    accumulateAdjoints<AccumulatorTypeT<T>>(                                   \
+        std::vector<NodePtr<T>> &,                                             \
+        std::unordered_map<const Node<T> *, std::size_t> &,                    \
+        std::vector<AccumulatorTypeT<T>> &&, Summation, GraphRetention);       \
+    LENINGRAD_TEMPLATE DiffValue<T> evaluateDerivative(const Edge<T> &);       \
+    LENINGRAD_TEMPLATE AccumulatorTypeT<T>                                     \
+    edgePartial<AccumulatorTypeT<T>>(const Node<T> &, const Edge<T> &);        \
+    LENINGRAD_TEMPLATE DiffValue<T> sumNode(const std::vector<DiffValue<T>> &, \
+                                            T);                                \
+    LENINGRAD_TEMPLATE class ProductPartials<T>;
+
+namespace leningrad {
+LENINGRAD_UNARY_OPS(double)
+LENINGRAD_UNARY_OPS(float)
+LENINGRAD_BINARY_OPS(double)
+LENINGRAD_BINARY_OPS(float)
+LENINGRAD_SCALAR_OPS(double, double)
+LENINGRAD_SCALAR_OPS(double, int)
+LENINGRAD_SCALAR_OPS(float, float)
+LENINGRAD_SCALAR_OPS(float, int)
+LENINGRAD_DERIVATIVES(double)
+LENINGRAD_DERIVATIVES(float)
+
+namespace impl {
+LENINGRAD_IMPL(double)
+LENINGRAD_IMPL(float)
+} // namespace impl
+} // namespace leningrad
+
+#undef LENINGRAD_UNARY_OPS
+#undef LENINGRAD_BINARY_OPS
+#undef LENINGRAD_SCALAR_OPS
+#undef LENINGRAD_DERIVATIVES
+#undef LENINGRAD_IMPL
+#undef LENINGRAD_TEMPLATE
+
+#endif
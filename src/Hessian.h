@@ -0,0 +1,295 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "ComputationGraph.h"
+#include "Derivative.h"
+#include "DiffValue.h"
+
+namespace leningrad {
+
+/**
+ * The second derivatives of a value wrt a list of inputs, as computed by
+ * hessian(). Only the nonzero entries of the lower triangle are stored.
+ */
+template <typename T> class SparseHessian {
+public:
+    struct Entry {
+        std::size_t row;
+        std::size_t col;
+        T value;
+    };
+
+    SparseHessian(std::size_t n, std::vector<Entry> entries,
+                  std::vector<T> gradient)
+        : n(n), lower(std::move(entries)),
+          firstDerivatives(std::move(gradient)) {
+        std::sort(lower.begin(), lower.end(),
+                  [](const Entry &a, const Entry &b) {
+                      return a.row != b.row ? a.row < b.row : a.col < b.col;
+                  });
+    }
+
+    /**
+     * The number of inputs, i.e. the number of rows and columns.
+     */
+    std::size_t size() const { return n; }
+
+    /**
+     * The nonzero entries with row >= col, ordered by row, then column.
+     * Rows and columns are indices into the inputs.
+     */
+    const std::vector<Entry> &entries() const { return lower; }
+
+    /**
+     * The second derivative wrt inputs i and j, in either order.
+     */
+    T operator()(std::size_t i, std::size_t j) const {
+        if (i < j) {
+            std::swap(i, j);
+        }
+        auto itr = std::lower_bound(
+            lower.begin(), lower.end(), std::make_pair(i, j),
+            [](const Entry &entry,
+               const std::pair<std::size_t, std::size_t> &key) {
+                return entry.row != key.first ? entry.row < key.first
+                                              : entry.col < key.second;
+            });
+        return itr != lower.end() && itr->row == i && itr->col == j
+                   ? itr->value
+                   : T(0);
+    }
+
+    /**
+     * The first derivatives wrt each input, which the sweep computes along
+     * the way.
+     */
+    const std::vector<T> &gradient() const { return firstDerivatives; }
+
+private:
+    std::size_t n;
+    std::vector<Entry> lower;
+    std::vector<T> firstDerivatives;
+};
+
+namespace impl {
+// a symmetric sparse matrix over node positions, storing each off-diagonal
+// entry in both rows so a node's row can be read directly
+template <typename Acc> class SymmetricAdjacency {
+public:
+    explicit SymmetricAdjacency(std::size_t n) : rows(n) {}
+
+    void add(std::size_t a, std::size_t b, Acc value) {
+        if (value == Acc(0)) {
+            return;
+        }
+        rows[a][b] += value;
+        if (a != b) {
+            rows[b][a] += value;
+        }
+    }
+
+    const std::unordered_map<std::size_t, Acc> &row(std::size_t a) const {
+        return rows[a];
+    }
+
+    // removes a and everything it is connected to
+    void erase(std::size_t a) {
+        for (const auto &[b, value] : rows[a]) {
+            if (b != a) {
+                rows[b].erase(a);
+            }
+        }
+        std::unordered_map<std::size_t, Acc>().swap(rows[a]);
+    }
+
+private:
+    std::vector<std::unordered_map<std::size_t, Acc>> rows;
+};
+
+/**
+ * Adds the numeric derivatives of partial wrt each of the given nodes to the
+ * matching element of out, without looking past those nodes.
+ */
+template <typename Acc, typename T>
+void localGradient(
+    const DiffValue<T> &partial,
+    const std::unordered_map<const Node<T> *, std::size_t> &targets,
+    const std::unordered_set<const Node<T> *> &stopAt, Acc *out) {
+    const NodePtr<T> &root = getDiffValueNode(partial);
+    if (root->edges.empty()) {
+        auto itr = targets.find(root.get());
+        if (itr != targets.end()) {
+            out[itr->second] += Acc(1);
+        }
+        return;
+    }
+    std::unordered_map<const Node<T> *, std::size_t> positions;
+    auto order = topologicalOrder(root, &positions, &stopAt);
+    std::vector<Acc> adjoints(order.size(), Acc(0));
+    adjoints[0] = Acc(1);
+    for (std::size_t i = 0; i < order.size(); i++) {
+        auto itr = targets.find(order[i].get());
+        if (itr != targets.end()) {
+            out[itr->second] += adjoints[i];
+            continue;
+        }
+        if (adjoints[i] == Acc(0)) {
+            continue;
+        }
+        for (const Edge<T> &edge : order[i]->edges) {
+            adjoints[positions.at(edge.to.get())] +=
+                edgePartial<Acc>(*order[i], edge) * adjoints[i];
+        }
+    }
+}
+} // namespace impl
+
+/**
+ * Computes all the second derivatives of value wrt the given inputs in a
+ * single reverse sweep, by edge pushing.
+ *
+ * Each node's partial derivatives are differentiated once more, locally
+ * (back to the node's own children), and the resulting second-order
+ * contributions are pushed down the graph together with the adjoints. Only
+ * pairs of nodes that actually interact are ever stored, so for sparse
+ * Hessians the cost is close to that of a few gradients instead of one
+ * derivative graph per entry. The inputs are treated as independent
+ * variables, and must be distinct.
+ */
+template <typename T>
+SparseHessian<T> hessian(const DiffValue<T> &value,
+                         const std::vector<DiffValue<T>> &inputs) {
+    using Acc = AccumulatorTypeT<T>;
+    std::unordered_set<const impl::Node<T> *> inputNodes;
+    for (const DiffValue<T> &input : inputs) {
+        if (!inputNodes.insert(impl::getDiffValueNode(input).get()).second) {
+            throw std::invalid_argument("Hessian inputs must be distinct");
+        }
+    }
+
+    std::unordered_map<const impl::Node<T> *, std::size_t> positions;
+    auto order = impl::topologicalOrder(impl::getDiffValueNode(value),
+                                        &positions, &inputNodes);
+    std::vector<Acc> adjoints(order.size(), Acc(0));
+    adjoints[0] = Acc(1);
+    impl::SymmetricAdjacency<Acc> w(order.size());
+
+    std::vector<std::size_t> children;
+    std::unordered_map<const impl::Node<T> *, std::size_t> childIndex;
+    std::unordered_set<const impl::Node<T> *> childSet;
+    std::vector<Acc> partials;
+    std::vector<Acc> second;
+    for (std::size_t i = 0; i < order.size(); i++) {
+        const impl::Node<T> &node = *order[i];
+        if (node.edges.empty() || inputNodes.count(&node)) {
+            continue;
+        }
+        if (node.has(impl::Node<T>::Nonlocal)) {
+            throw std::domain_error("Can't push edges through a node whose "
+                                    "partials depend on more than its "
+                                    "children, e.g. from solve()");
+        }
+
+        // first and local second partials wrt each distinct child, with
+        // edges to the same child merged
+        children.clear();
+        childIndex.clear();
+        childSet.clear();
+        for (const impl::Edge<T> &edge : node.edges) {
+            if (childIndex.emplace(edge.to.get(), children.size()).second) {
+                children.push_back(positions.at(edge.to.get()));
+                childSet.insert(edge.to.get());
+            }
+        }
+        std::size_t m = children.size();
+        partials.assign(m, Acc(0));
+        // left empty while every partial is a constant, as for sums
+        second.clear();
+        for (const impl::Edge<T> &edge : node.edges) {
+            std::size_t j = childIndex.at(edge.to.get());
+            DiffValue<T> partial = impl::evaluateDerivative(edge);
+            partials[j] += static_cast<Acc>(partial.value());
+            const auto &partialNode = impl::getDiffValueNode(partial);
+            if (adjoints[i] != Acc(0) &&
+                (!partialNode->edges.empty() ||
+                 childSet.count(partialNode.get()))) {
+                if (second.empty()) {
+                    second.assign(m * m, Acc(0));
+                }
+                impl::localGradient(partial, childIndex, childSet,
+                                    &second[j * m]);
+            }
+        }
+
+        // pushing: move the second-order entries of this node onto its
+        // children
+        for (const auto &[p, weight] : w.row(i)) {
+            if (p == i) {
+                continue;
+            }
+            for (std::size_t j = 0; j < m; j++) {
+                if (children[j] == p) {
+                    w.add(p, p, 2 * partials[j] * weight);
+                } else {
+                    w.add(children[j], p, partials[j] * weight);
+                }
+            }
+        }
+        auto diagonal = w.row(i).find(i);
+        if (diagonal != w.row(i).end()) {
+            Acc weight = diagonal->second;
+            for (std::size_t j = 0; j < m; j++) {
+                for (std::size_t k = 0; k <= j; k++) {
+                    w.add(children[j], children[k],
+                          partials[j] * partials[k] * weight);
+                }
+            }
+        }
+
+        // creating: this node's own curvature, scaled by its adjoint
+        if (!second.empty()) {
+            for (std::size_t j = 0; j < m; j++) {
+                for (std::size_t k = 0; k <= j; k++) {
+                    w.add(children[j], children[k],
+                          adjoints[i] * second[j * m + k]);
+                }
+            }
+        }
+        if (adjoints[i] != Acc(0)) {
+            for (std::size_t j = 0; j < m; j++) {
+                adjoints[children[j]] += adjoints[i] * partials[j];
+            }
+        }
+        w.erase(i);
+    }
+
+    std::vector<typename SparseHessian<T>::Entry> entries;
+    std::vector<T> gradient(inputs.size(), T(0));
+    std::unordered_map<std::size_t, std::size_t> inputIndex;
+    for (std::size_t a = 0; a < inputs.size(); a++) {
+        auto itr = positions.find(impl::getDiffValueNode(inputs[a]).get());
+        if (itr != positions.end()) {
+            inputIndex.emplace(itr->second, a);
+            gradient[a] = static_cast<T>(adjoints[itr->second]);
+        }
+    }
+    for (const auto &[position, a] : inputIndex) {
+        for (const auto &[q, weight] : w.row(position)) {
+            auto other = inputIndex.find(q);
+            if (other != inputIndex.end() && other->second <= a) {
+                entries.push_back({a, other->second, static_cast<T>(weight)});
+            }
+        }
+    }
+    return SparseHessian<T>(inputs.size(), std::move(entries),
+                            std::move(gradient));
+}
+
+} // namespace leningrad
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "Derivative.h"
+#include "DiffValue.h"
+#include "LinearAlgebra.h"
+
+namespace leningrad {
+
+/**
+ * A system of equations g(x, theta) = 0, with as many equations as there
+ * are elements of x.
+ */
+template <typename T>
+using ImplicitSystem = std::function<std::vector<DiffValue<T>>(
+    const std::vector<DiffValue<T>> &x, const std::vector<DiffValue<T>> &theta)>;
+
+namespace impl {
+template <typename T> class ImplicitSensitivity {
+public:
+    ImplicitSensitivity(ImplicitSystem<T> g, std::vector<T> xStar,
+                        std::vector<T> thetaValues)
+        : g(std::move(g)), xStar(std::move(xStar)),
+          thetaValues(std::move(thetaValues)) {}
+
+    // dx_i/dtheta_j
+    T get(std::size_t i, std::size_t j) {
+        std::call_once(solved, [this]() { solve(); });
+        return sensitivities[i * thetaValues.size() + j];
+    }
+
+private:
+    void solve() {
+        std::size_t n = xStar.size();
+        std::size_t p = thetaValues.size();
+        std::vector<DiffValue<T>> leaves;
+        leaves.reserve(n + p);
+        for (T value : xStar) {
+            leaves.emplace_back(value);
+        }
+        for (T value : thetaValues) {
+            leaves.emplace_back(value);
+        }
+        std::vector<DiffValue<T>> x(leaves.begin(), leaves.begin() + n);
+        std::vector<DiffValue<T>> theta(leaves.begin() + n, leaves.end());
+        std::vector<DiffValue<T>> residuals = g(x, theta);
+        if (residuals.size() != n) {
+            throw std::invalid_argument(
+                "An implicit system needs one equation per unknown");
+        }
+
+        // row k of [dg/dx | dg/dtheta]
+        std::vector<T> jacobianX(n * n);
+        std::vector<T> jacobianTheta(n * p);
+        std::vector<T> row(n + p);
+        for (std::size_t k = 0; k < n; k++) {
+            gradient(residuals[k], leaves.begin(), leaves.end(), row.data());
+            std::copy(row.begin(), row.begin() + n, &jacobianX[k * n]);
+            std::copy(row.begin() + n, row.end(), &jacobianTheta[k * p]);
+        }
+
+        // for each x_i, solve the adjoint system dg/dx^T lambda = e_i, then
+        // dx_i/dtheta = -lambda^T dg/dtheta
+        LUFactorization<T> lu(std::move(jacobianX), n);
+        sensitivities.assign(n * p, T(0));
+        std::vector<T> lambda(n);
+        for (std::size_t i = 0; i < n; i++) {
+            std::fill(lambda.begin(), lambda.end(), T(0));
+            lambda[i] = 1;
+            lu.solveTransposed(lambda.data());
+            for (std::size_t k = 0; k < n; k++) {
+                for (std::size_t j = 0; j < p; j++) {
+                    sensitivities[i * p + j] -=
+                        lambda[k] * jacobianTheta[k * p + j];
+                }
+            }
+        }
+    }
+
+    ImplicitSystem<T> g;
+    std::vector<T> xStar;
+    std::vector<T> thetaValues;
+    std::vector<T> sensitivities;
+    std::once_flag solved;
+};
+} // namespace impl
+
+/**
+ * Differentiates the solution of g(x, theta) = 0 by the implicit function
+ * theorem, instead of through the iterations that found it.
+ *
+ * Given a converged solution xStar, returns x as values that depend on
+ * theta: the first time their derivatives are needed, g is evaluated once at
+ * (xStar, theta) and the adjoint system dg/dx^T lambda = e_i is solved for
+ * each x_i. The cost is independent of how many iterations the solver took.
+ * The sensitivities are plain numbers, see primitive().
+ */
+template <typename T>
+std::vector<DiffValue<T>>
+implicitSolution(ImplicitSystem<T> g, const std::vector<T> &xStar,
+                 const std::vector<DiffValue<T>> &theta) {
+    std::vector<T> thetaValues;
+    thetaValues.reserve(theta.size());
+    for (const DiffValue<T> &t : theta) {
+        thetaValues.push_back(t.value());
+    }
+    auto sensitivity = std::make_shared<impl::ImplicitSensitivity<T>>(
+        std::move(g), xStar, std::move(thetaValues));
+
+    std::vector<DiffValue<T>> solution;
+    solution.reserve(xStar.size());
+    for (std::size_t i = 0; i < xStar.size(); i++) {
+        std::vector<impl::Edge<T>> edges;
+        edges.reserve(theta.size());
+        for (std::size_t j = 0; j < theta.size(); j++) {
+            edges.emplace_back(impl::getDiffValueNode(theta[j]),
+                               [sensitivity, i, j]() {
+                                   return DiffValue<T>(sensitivity->get(i, j));
+                               });
+        }
+        auto node = impl::makeNode<T>(xStar[i], std::move(edges));
+        solution.push_back(impl::createDiffValueFromNode(std::move(node)));
+    }
+    return solution;
+}
+
+/**
+ * implicitSolution() for a single equation g(x, theta) = 0.
+ */
+template <typename T>
+DiffValue<T> implicitSolution(
+    const std::function<DiffValue<T>(const DiffValue<T> &x,
+                                     const std::vector<DiffValue<T>> &theta)>
+        &g,
+    T xStar, const std::vector<DiffValue<T>> &theta) {
+    ImplicitSystem<T> system = [g](const std::vector<DiffValue<T>> &x,
+                                   const std::vector<DiffValue<T>> &theta) {
+        return std::vector<DiffValue<T>>{g(x[0], theta)};
+    };
+    return implicitSolution(std::move(system), std::vector<T>{xStar}, theta)
+        .front();
+}
+
+} // namespace leningrad
@@ -0,0 +1,5 @@
+// The leningrad_compiled library: instantiates, once, the templates
+// ExternTemplates.h declares extern for translation units built with
+// LENINGRAD_COMPILED.
+#define LENINGRAD_INSTANTIATE
+#include "Core.h"
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+namespace leningrad::impl {
+
+/**
+ * A non-atomic reference counted pointer, used for graph nodes when
+ * LENINGRAD_SINGLE_THREADED is defined.
+ *
+ * The pointee keeps its own count in a `refCount` member, and is released
+ * through the static `U::destroy()` when the last reference goes away.
+ */
+template <typename U> class IntrusivePtr {
+public:
+    IntrusivePtr() noexcept : ptr(nullptr) {}
+
+    explicit IntrusivePtr(U *ptr) noexcept : ptr(ptr) { retain(); }
+
+    IntrusivePtr(const IntrusivePtr &other) noexcept : ptr(other.ptr) {
+        retain();
+    }
+
+    IntrusivePtr(IntrusivePtr &&other) noexcept : ptr(other.ptr) {
+        other.ptr = nullptr;
+    }
+
+    ~IntrusivePtr() { release(); }
+
+    IntrusivePtr &operator=(const IntrusivePtr &other) noexcept {
+        IntrusivePtr(other).swap(*this);
+        return *this;
+    }
+
+    IntrusivePtr &operator=(IntrusivePtr &&other) noexcept {
+        IntrusivePtr(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    void reset() noexcept { IntrusivePtr().swap(*this); }
+
+    void swap(IntrusivePtr &other) noexcept { std::swap(ptr, other.ptr); }
+
+    U *get() const noexcept { return ptr; }
+
+    U &operator*() const noexcept { return *ptr; }
+
+    U *operator->() const noexcept { return ptr; }
+
+    explicit operator bool() const noexcept { return ptr != nullptr; }
+
+    std::size_t use_count() const noexcept { return ptr ? ptr->refCount : 0; }
+
+    friend bool operator==(const IntrusivePtr &lhs, const IntrusivePtr &rhs) {
+        return lhs.ptr == rhs.ptr;
+    }
+
+    friend bool operator!=(const IntrusivePtr &lhs, const IntrusivePtr &rhs) {
+        return lhs.ptr != rhs.ptr;
+    }
+
+private:
+    void retain() noexcept {
+        if (ptr) {
+            ptr->refCount++;
+        }
+    }
+
+    void release() noexcept {
+        if (ptr && --ptr->refCount == 0) {
+            U::destroy(ptr);
+        }
+    }
+
+    U *ptr;
+};
+
+} // namespace leningrad::impl
+
+namespace std {
+template <typename U> struct hash<leningrad::impl::IntrusivePtr<U>> {
+    std::size_t
+    operator()(const leningrad::impl::IntrusivePtr<U> &ptr) const noexcept {
+        return std::hash<U *>()(ptr.get());
+    }
+};
+} // namespace std
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace leningrad::impl {
+
+/**
+ * An LU factorization with partial pivoting of a dense, row-major n x n
+ * matrix of plain numbers.
+ */
+template <typename T> class LUFactorization {
+public:
+    LUFactorization(std::vector<T> matrix, std::size_t n)
+        : lu(std::move(matrix)), pivots(n), n(n), sign(1) {
+        if (lu.size() != n * n) {
+            throw std::invalid_argument("Matrix must be n x n");
+        }
+        for (std::size_t k = 0; k < n; k++) {
+            std::size_t pivot = k;
+            for (std::size_t i = k + 1; i < n; i++) {
+                if (std::abs(lu[i * n + k]) > std::abs(lu[pivot * n + k])) {
+                    pivot = i;
+                }
+            }
+            if (lu[pivot * n + k] == T(0)) {
+                throw std::domain_error("Matrix is singular");
+            }
+            pivots[k] = pivot;
+            if (pivot != k) {
+                sign = -sign;
+                for (std::size_t j = 0; j < n; j++) {
+                    std::swap(lu[k * n + j], lu[pivot * n + j]);
+                }
+            }
+            T inverse = T(1) / lu[k * n + k];
+            for (std::size_t i = k + 1; i < n; i++) {
+                T factor = lu[i * n + k] *= inverse;
+                // row updates walk memory contiguously
+                const T *pivotRow = &lu[k * n];
+                T *row = &lu[i * n];
+                for (std::size_t j = k + 1; j < n; j++) {
+                    row[j] -= factor * pivotRow[j];
+                }
+            }
+        }
+    }
+
+    std::size_t size() const { return n; }
+
+    /**
+     * Solves A x = b in place.
+     */
+    void solve(T *b) const {
+        for (std::size_t k = 0; k < n; k++) {
+            std::swap(b[k], b[pivots[k]]);
+        }
+        for (std::size_t i = 0; i < n; i++) {
+            const T *row = &lu[i * n];
+            for (std::size_t j = 0; j < i; j++) {
+                b[i] -= row[j] * b[j];
+            }
+        }
+        for (std::size_t i = n; i-- > 0;) {
+            const T *row = &lu[i * n];
+            for (std::size_t j = i + 1; j < n; j++) {
+                b[i] -= row[j] * b[j];
+            }
+            b[i] /= row[i];
+        }
+    }
+
+    /**
+     * Solves A^T x = b in place.
+     */
+    void solveTransposed(T *b) const {
+        for (std::size_t j = 0; j < n; j++) {
+            b[j] /= lu[j * n + j];
+            for (std::size_t i = j + 1; i < n; i++) {
+                b[i] -= lu[j * n + i] * b[j];
+            }
+        }
+        for (std::size_t j = n; j-- > 0;) {
+            for (std::size_t i = 0; i < j; i++) {
+                b[i] -= lu[j * n + i] * b[j];
+            }
+        }
+        for (std::size_t k = n; k-- > 0;) {
+            std::swap(b[k], b[pivots[k]]);
+        }
+    }
+
+    /**
+     * log |det A|
+     */
+    T logAbsDeterminant() const {
+        T result = 0;
+        for (std::size_t i = 0; i < n; i++) {
+            result += std::log(std::abs(lu[i * n + i]));
+        }
+        return result;
+    }
+
+    /**
+     * The sign of det A.
+     */
+    int determinantSign() const {
+        int result = sign;
+        for (std::size_t i = 0; i < n; i++) {
+            if (lu[i * n + i] < T(0)) {
+                result = -result;
+            }
+        }
+        return result;
+    }
+
+private:
+    std::vector<T> lu;
+    std::vector<std::size_t> pivots;
+    std::size_t n;
+    int sign;
+};
+
+/**
+ * The Cholesky factorization A = L L^T of a dense, row-major, symmetric
+ * positive definite n x n matrix of plain numbers. Only the lower triangle
+ * of the matrix is read.
+ *
+ * The factorization works on square blocks, so that the trailing update,
+ * which does almost all of the work, reuses each block while it is in
+ * cache.
+ */
+template <typename T> class CholeskyFactorization {
+public:
+    static constexpr std::size_t blockSize = 32;
+
+    CholeskyFactorization(std::vector<T> matrix, std::size_t n)
+        : l(std::move(matrix)), n(n) {
+        if (l.size() != n * n) {
+            throw std::invalid_argument("Matrix must be n x n");
+        }
+        for (std::size_t k0 = 0; k0 < n; k0 += blockSize) {
+            std::size_t k1 = std::min(k0 + blockSize, n);
+            // the diagonal block, then the panel below it
+            for (std::size_t j = k0; j < k1; j++) {
+                T d = l[j * n + j] - dot(j, j, k0, j);
+                if (!(d > T(0))) {
+                    throw std::domain_error("Matrix is not positive definite");
+                }
+                T pivot = std::sqrt(d);
+                l[j * n + j] = pivot;
+                for (std::size_t i = j + 1; i < n; i++) {
+                    l[i * n + j] = (l[i * n + j] - dot(i, j, k0, j)) / pivot;
+                }
+            }
+            // the trailing update, one tile of columns at a time
+            for (std::size_t j0 = k1; j0 < n; j0 += blockSize) {
+                std::size_t j1 = std::min(j0 + blockSize, n);
+                for (std::size_t i = j0; i < n; i++) {
+                    for (std::size_t j = j0; j < std::min(j1, i + 1); j++) {
+                        l[i * n + j] -= dot(i, j, k0, k1);
+                    }
+                }
+            }
+        }
+        for (std::size_t i = 0; i < n; i++) {
+            std::fill(&l[i * n + i + 1], &l[i * n] + n, T(0));
+        }
+    }
+
+    std::size_t size() const { return n; }
+
+    /**
+     * L, row-major, with zeros above the diagonal.
+     */
+    const std::vector<T> &lower() const { return l; }
+
+private:
+    // the sum of L_ik L_jk over k in [begin, end)
+    T dot(std::size_t i, std::size_t j, std::size_t begin,
+          std::size_t end) const {
+        const T *a = &l[i * n];
+        const T *b = &l[j * n];
+        T result = 0;
+        for (std::size_t k = begin; k < end; k++) {
+            result += a[k] * b[k];
+        }
+        return result;
+    }
+
+    std::vector<T> l;
+    std::size_t n;
+};
+
+} // namespace leningrad::impl
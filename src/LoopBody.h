@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "ComputationGraph.h"
+#include "Derivative.h"
+#include "DiffValue.h"
+
+namespace leningrad {
+
+/**
+ * One iteration of a loop: the next state, from the current state and
+ * whatever else the iteration depends on.
+ */
+template <typename T>
+using LoopBodyFunction = std::function<std::vector<DiffValue<T>>(
+    const std::vector<DiffValue<T>> &state,
+    const std::vector<DiffValue<T>> &inputs)>;
+
+namespace impl {
+// The input values of one iteration of a LoopBody, and the Jacobian of its
+// outputs, found by replaying the body the first time it is needed.
+template <typename T> class LoopIteration {
+public:
+    LoopIteration(std::shared_ptr<const LoopBodyFunction<T>> body,
+                  std::vector<T> values, std::size_t stateSize)
+        : body(std::move(body)), values(std::move(values)),
+          stateSize(stateSize), inputCount(this->values.size()) {}
+
+    // d output_i / d input_j, with the state first among the inputs
+    T get(std::size_t i, std::size_t j) {
+        std::call_once(replayed, [this]() { replay(); });
+        return jacobian[i * inputCount + j];
+    }
+
+private:
+    void replay() {
+        std::vector<DiffValue<T>> leaves(values.begin(), values.end());
+        std::vector<DiffValue<T>> state(leaves.begin(),
+                                        leaves.begin() + stateSize);
+        std::vector<DiffValue<T>> inputs(leaves.begin() + stateSize,
+                                         leaves.end());
+        std::vector<DiffValue<T>> outputs = (*body)(state, inputs);
+        jacobian.resize(outputs.size() * inputCount);
+        for (std::size_t i = 0; i < outputs.size(); i++) {
+            gradient(outputs[i], leaves.begin(), leaves.end(),
+                     &jacobian[i * inputCount]);
+        }
+        // the values are only needed to replay
+        std::vector<T>().swap(values);
+    }
+
+    std::shared_ptr<const LoopBodyFunction<T>> body;
+    std::vector<T> values;
+    std::size_t stateSize;
+    std::size_t inputCount;
+    std::vector<T> jacobian;
+    std::once_flag replayed;
+};
+} // namespace impl
+
+/**
+ * A loop body whose iterations are recorded without their graphs.
+ *
+ * Each call evaluates the body on plain copies of its arguments, and
+ * records only their values and one node per output, with an edge to each
+ * argument. The body itself, shared by all iterations, is the structure:
+ * the first time an iteration's derivatives are needed, it is replayed on
+ * the stored values and differentiated, and then only its Jacobian is
+ * kept. A loop of many iterations of a large body then stores a node per
+ * output and an edge per output and argument for each iteration, instead
+ * of a copy of the body's graph.
+ *
+ * Everything an iteration depends on must be passed in, as the state or
+ * the inputs: values captured by the body would be the same in every
+ * replay. Only the Jacobian's numbers are kept, see primitive().
+ */
+template <typename T> class LoopBody {
+public:
+    explicit LoopBody(LoopBodyFunction<T> fn)
+        : body(std::make_shared<const LoopBodyFunction<T>>(std::move(fn))) {}
+
+    std::vector<DiffValue<T>>
+    operator()(const std::vector<DiffValue<T>> &state,
+               const std::vector<DiffValue<T>> &inputs = {}) const {
+        std::vector<T> values;
+        values.reserve(state.size() + inputs.size());
+        for (const DiffValue<T> &x : state) {
+            values.push_back(x.value());
+        }
+        for (const DiffValue<T> &x : inputs) {
+            values.push_back(x.value());
+        }
+
+        std::vector<T> outputValues;
+        {
+            std::vector<DiffValue<T>> stateLeaves(values.begin(),
+                                                  values.begin() +
+                                                      state.size());
+            std::vector<DiffValue<T>> inputLeaves(
+                values.begin() + state.size(), values.end());
+            for (const DiffValue<T> &output : (*body)(stateLeaves,
+                                                      inputLeaves)) {
+                outputValues.push_back(output.value());
+            }
+        }
+
+        auto iteration = std::make_shared<impl::LoopIteration<T>>(
+            body, std::move(values), state.size());
+        std::vector<DiffValue<T>> outputs;
+        outputs.reserve(outputValues.size());
+        for (std::size_t i = 0; i < outputValues.size(); i++) {
+            std::vector<impl::Edge<T>> edges;
+            edges.reserve(state.size() + inputs.size());
+            for (std::size_t j = 0; j < state.size() + inputs.size(); j++) {
+                const DiffValue<T> &argument =
+                    j < state.size() ? state[j] : inputs[j - state.size()];
+                edges.emplace_back(impl::getDiffValueNode(argument),
+                                   [iteration, i, j]() {
+                                       return DiffValue<T>(
+                                           iteration->get(i, j));
+                                   });
+            }
+            auto node = impl::makeNode<T>(outputValues[i], std::move(edges));
+            outputs.push_back(impl::createDiffValueFromNode(std::move(node)));
+        }
+        return outputs;
+    }
+
+private:
+    std::shared_ptr<const LoopBodyFunction<T>> body;
+};
+
+} // namespace leningrad
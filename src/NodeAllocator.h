@@ -0,0 +1,247 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+
+namespace leningrad {
+
+namespace impl {
+
+/**
+ * A size-class pool for computation graph nodes.
+ *
+ * Nodes and their shared_ptr control blocks are small and allocated in huge
+ * numbers, so this resource serves them from per-thread free lists of
+ * fixed-size blocks, carved out of large chunks. Blocks freed on another
+ * thread go to that thread's cache, and caches that grow too large hand
+ * batches back to a shared depot, so producer/consumer thread pairs don't
+ * grow without bound. Chunks are retained for the lifetime of the process.
+ */
+class SizeClassPool : public std::pmr::memory_resource {
+public:
+    static constexpr std::size_t granularity = 16;
+    static constexpr std::size_t maxBlockSize = 256;
+    static constexpr std::size_t numClasses = maxBlockSize / granularity;
+    static constexpr std::size_t chunkSize = 64 * 1024;
+    static constexpr std::size_t batchSize = 64;
+
+private:
+    struct Block {
+        Block *next;
+    };
+
+    struct Depot {
+        std::mutex mutex;
+        std::array<Block *, numClasses> lists{};
+    };
+
+    struct ThreadCache {
+        std::array<Block *, numClasses> lists{};
+        std::array<std::size_t, numClasses> counts{};
+
+        ~ThreadCache() {
+            cacheDestroyed() = true;
+            for (std::size_t c = 0; c < numClasses; c++) {
+                if (lists[c]) {
+                    giveToDepot(c, lists[c]);
+                    lists[c] = nullptr;
+                }
+            }
+        }
+    };
+
+    static Depot &depot() {
+        // leaked on purpose, since nodes may be freed during static destruction
+        static Depot *instance = new Depot();
+        return *instance;
+    }
+
+    // Trivially destructible, so it can still be read while the thread's
+    // other thread_locals (and with them any nodes) are being destroyed.
+    static bool &cacheDestroyed() {
+        thread_local bool destroyed = false;
+        return destroyed;
+    }
+
+    // The calling thread's cache, or nullptr if it has already been
+    // destroyed because the thread is exiting.
+    static ThreadCache *cache() {
+        if (cacheDestroyed()) {
+            return nullptr;
+        }
+        thread_local ThreadCache instance;
+        return &instance;
+    }
+
+    static std::size_t classOf(std::size_t bytes) {
+        // 0 bytes still take a block
+        return bytes == 0 ? 0 : (bytes + granularity - 1) / granularity - 1;
+    }
+
+    static void giveToDepot(std::size_t c, Block *chain) {
+        Block *tail = chain;
+        while (tail->next) {
+            tail = tail->next;
+        }
+        Depot &d = depot();
+        std::lock_guard<std::mutex> lock(d.mutex);
+        tail->next = d.lists[c];
+        d.lists[c] = chain;
+    }
+
+    static Block *takeFromDepot(std::size_t c, std::size_t &count) {
+        Depot &d = depot();
+        std::lock_guard<std::mutex> lock(d.mutex);
+        Block *head = d.lists[c];
+        if (!head) {
+            return nullptr;
+        }
+        Block *tail = head;
+        count = 1;
+        while (tail->next && count < batchSize) {
+            tail = tail->next;
+            count++;
+        }
+        d.lists[c] = tail->next;
+        tail->next = nullptr;
+        return head;
+    }
+
+    static Block *carveChunk(std::size_t c, std::size_t &count) {
+        std::size_t blockSize = (c + 1) * granularity;
+        count = chunkSize / blockSize;
+        auto *chunk = static_cast<char *>(::operator new(chunkSize));
+        for (std::size_t i = 0; i + 1 < count; i++) {
+            reinterpret_cast<Block *>(chunk + i * blockSize)->next =
+                reinterpret_cast<Block *>(chunk + (i + 1) * blockSize);
+        }
+        reinterpret_cast<Block *>(chunk + (count - 1) * blockSize)->next =
+            nullptr;
+        return reinterpret_cast<Block *>(chunk);
+    }
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (bytes > maxBlockSize || alignment > granularity) {
+            return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        }
+        std::size_t c = classOf(bytes);
+        ThreadCache *tc = cache();
+        if (!tc) {
+            // take a single block, and leave the rest of the batch
+            std::size_t count = 0;
+            Block *block = takeFromDepot(c, count);
+            if (!block) {
+                block = carveChunk(c, count);
+            }
+            if (block->next) {
+                giveToDepot(c, block->next);
+            }
+            return block;
+        }
+        if (!tc->lists[c]) {
+            std::size_t count = 0;
+            Block *refill = takeFromDepot(c, count);
+            tc->lists[c] = refill ? refill : carveChunk(c, count);
+            tc->counts[c] = count;
+        }
+        Block *block = tc->lists[c];
+        tc->lists[c] = block->next;
+        tc->counts[c]--;
+        return block;
+    }
+
+    void do_deallocate(void *p, std::size_t bytes,
+                       std::size_t alignment) override {
+        if (bytes > maxBlockSize || alignment > granularity) {
+            std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+            return;
+        }
+        std::size_t c = classOf(bytes);
+        auto *block = static_cast<Block *>(p);
+        ThreadCache *tc = cache();
+        if (!tc) {
+            block->next = nullptr;
+            giveToDepot(c, block);
+            return;
+        }
+        block->next = tc->lists[c];
+        tc->lists[c] = block;
+        if (++tc->counts[c] > 2 * batchSize) {
+            // hand the oldest half of the list back to the depot
+            Block *tail = tc->lists[c];
+            for (std::size_t i = 1; i < batchSize; i++) {
+                tail = tail->next;
+            }
+            Block *rest = tail->next;
+            tail->next = nullptr;
+            giveToDepot(c, rest);
+            tc->counts[c] = batchSize;
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const
+        noexcept override {
+        return this == &other;
+    }
+};
+
+inline std::pmr::memory_resource *&currentNodeResource() {
+    thread_local std::pmr::memory_resource *resource = nullptr;
+    return resource;
+}
+
+} // namespace impl
+
+/**
+ * The resource nodes are allocated from when none has been set: a
+ * process-wide SizeClassPool.
+ */
+inline std::pmr::memory_resource *defaultNodeResource() {
+    static impl::SizeClassPool *pool = new impl::SizeClassPool();
+    return pool;
+}
+
+/**
+ * The resource that nodes created on the calling thread are allocated from.
+ */
+inline std::pmr::memory_resource *getNodeResource() {
+    std::pmr::memory_resource *resource = impl::currentNodeResource();
+    return resource ? resource : defaultNodeResource();
+}
+
+/**
+ * Sets the resource that nodes created on the calling thread are allocated
+ * from. Passing nullptr restores the default pool. Each node remembers the
+ * resource it came from, so the resource must outlive every node allocated
+ * from it.
+ */
+inline void setNodeResource(std::pmr::memory_resource *resource) {
+    impl::currentNodeResource() = resource;
+}
+
+/**
+ * Allocates nodes created on the calling thread from the given resource for
+ * the lifetime of this object, e.g. a std::pmr::monotonic_buffer_resource
+ * that reclaims a whole iteration's graph at once.
+ */
+class NodeResourceScope {
+public:
+    explicit NodeResourceScope(std::pmr::memory_resource *resource)
+        : previous(impl::currentNodeResource()) {
+        setNodeResource(resource);
+    }
+
+    NodeResourceScope(const NodeResourceScope &) = delete;
+    NodeResourceScope &operator=(const NodeResourceScope &) = delete;
+
+    ~NodeResourceScope() { setNodeResource(previous); }
+
+private:
+    std::pmr::memory_resource *previous;
+};
+
+} // namespace leningrad
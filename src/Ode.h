@@ -0,0 +1,410 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Derivative.h"
+#include "DiffValue.h"
+#include "Primitive.h"
+
+namespace leningrad {
+
+/**
+ * The right-hand side dy/dt = f(t, y, theta) of an ODE.
+ */
+template <typename T>
+using OdeFunction = std::function<std::vector<DiffValue<T>>(
+    T t, const std::vector<DiffValue<T>> &y,
+    const std::vector<DiffValue<T>> &theta)>;
+
+namespace impl {
+struct ButcherTableau {
+    std::size_t stages;
+    const double *c;
+    // row-major, stages x stages, strictly lower triangular
+    const double *a;
+    const double *b;
+    // the weights of the embedded error estimate, or null
+    const double *error;
+};
+
+inline const ButcherTableau &rk4Tableau() {
+    static constexpr double c[] = {0, 0.5, 0.5, 1};
+    static constexpr double a[] = {0,   0,   0, 0,
+                                   0.5, 0,   0, 0,
+                                   0,   0.5, 0, 0,
+                                   0,   0,   1, 0};
+    static constexpr double b[] = {1.0 / 6, 1.0 / 3, 1.0 / 3, 1.0 / 6};
+    static const ButcherTableau tableau{4, c, a, b, nullptr};
+    return tableau;
+}
+
+inline const ButcherTableau &dormandPrinceTableau() {
+    static constexpr double c[] = {0, 0.2, 0.3, 0.8, 8.0 / 9, 1, 1};
+    static constexpr double a[] = {
+        0, 0, 0, 0, 0, 0, 0,
+        0.2, 0, 0, 0, 0, 0, 0,
+        3.0 / 40, 9.0 / 40, 0, 0, 0, 0, 0,
+        44.0 / 45, -56.0 / 15, 32.0 / 9, 0, 0, 0, 0,
+        19372.0 / 6561, -25360.0 / 2187, 64448.0 / 6561, -212.0 / 729, 0, 0, 0,
+        9017.0 / 3168, -355.0 / 33, 46732.0 / 5247, 49.0 / 176,
+            -5103.0 / 18656, 0, 0,
+        35.0 / 384, 0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784, 11.0 / 84, 0};
+    static constexpr double b[] = {35.0 / 384, 0, 500.0 / 1113, 125.0 / 192,
+                                   -2187.0 / 6784, 11.0 / 84, 0};
+    // the fifth order weights minus the fourth order ones
+    static constexpr double error[] = {71.0 / 57600, 0, -71.0 / 16695,
+                                       71.0 / 1920, -17253.0 / 339200,
+                                       22.0 / 525, -1.0 / 40};
+    static const ButcherTableau tableau{7, c, a, b, error};
+    return tableau;
+}
+
+/**
+ * One explicit Runge-Kutta step from y at time t. If error is given, the
+ * embedded error estimate is written to it. Every intermediate state is a
+ * single linear node, so a step records little more than the nodes f
+ * creates.
+ */
+template <typename T>
+std::vector<DiffValue<T>>
+rungeKuttaStep(const ButcherTableau &tableau, const OdeFunction<T> &f, T t,
+               T h, const std::vector<DiffValue<T>> &y,
+               const std::vector<DiffValue<T>> &theta,
+               std::vector<T> *error = nullptr) {
+    std::size_t n = y.size();
+    std::size_t stages = tableau.stages;
+    if (!error) {
+        // stages only the error estimate uses aren't needed
+        while (stages > 0 && tableau.b[stages - 1] == 0) {
+            stages--;
+        }
+    }
+
+    // y + h sum_j weights_j k_j
+    auto combine = [&](const std::vector<std::vector<DiffValue<T>>> &k,
+                       const double *weights) {
+        std::vector<DiffValue<T>> result;
+        result.reserve(n);
+        for (std::size_t i = 0; i < n; i++) {
+            T value = y[i].value();
+            std::vector<DiffValue<T>> inputs{y[i]};
+            std::vector<T> partials{T(1)};
+            for (std::size_t j = 0; j < k.size(); j++) {
+                if (weights[j] != 0) {
+                    T weight = h * static_cast<T>(weights[j]);
+                    value += weight * k[j][i].value();
+                    inputs.push_back(k[j][i]);
+                    partials.push_back(weight);
+                }
+            }
+            result.push_back(inputs.size() == 1
+                                 ? y[i]
+                                 : primitive(value, std::move(inputs),
+                                             std::move(partials)));
+        }
+        return result;
+    };
+
+    std::vector<std::vector<DiffValue<T>>> k;
+    k.reserve(stages);
+    for (std::size_t s = 0; s < stages; s++) {
+        auto stage = s == 0 ? y : combine(k, &tableau.a[s * tableau.stages]);
+        k.push_back(f(t + static_cast<T>(tableau.c[s]) * h, stage, theta));
+        if (k.back().size() != n) {
+            throw std::invalid_argument(
+                "An ODE function must return one derivative per state");
+        }
+    }
+    if (error) {
+        error->assign(n, T(0));
+        for (std::size_t i = 0; i < n; i++) {
+            for (std::size_t s = 0; s < stages; s++) {
+                (*error)[i] += h * static_cast<T>(tableau.error[s]) *
+                               k[s][i].value();
+            }
+        }
+    }
+    return combine(k, tableau.b);
+}
+
+template <typename T>
+std::vector<DiffValue<T>> makeLeaves(const std::vector<T> &values) {
+    return std::vector<DiffValue<T>>(values.begin(), values.end());
+}
+
+template <typename T>
+std::vector<T> valuesOfState(const std::vector<DiffValue<T>> &y) {
+    std::vector<T> values;
+    values.reserve(y.size());
+    for (const DiffValue<T> &value : y) {
+        values.push_back(value.value());
+    }
+    return values;
+}
+
+/**
+ * An integration of an ODE, and the derivatives of its final state wrt the
+ * initial state and the parameters, by the discrete adjoint method.
+ *
+ * The forward pass keeps only the step sizes and, every checkpointInterval
+ * steps, the state, all as plain numbers. The first time a derivative is
+ * needed, the steps are swept backward: each segment between checkpoints is
+ * recomputed from its checkpoint, recording only that segment's graph, and
+ * the adjoints are pulled back through it one step at a time. These are the
+ * exact derivatives of the discrete integration, as taping it would give.
+ */
+template <typename T> class OdeIntegration {
+public:
+    OdeIntegration(OdeFunction<T> f, const ButcherTableau &tableau,
+                   std::vector<T> y0, std::vector<T> theta, T t0,
+                   std::size_t checkpointInterval)
+        : f(std::move(f)), tableau(tableau), theta(std::move(theta)),
+          checkpointInterval(std::max<std::size_t>(checkpointInterval, 1)),
+          t0(t0), y(std::move(y0)), t(t0) {
+        checkpoints.push_back(y);
+    }
+
+    const std::vector<T> &state() const { return y; }
+
+    // a trial step from the current state, which isn't taken
+    std::vector<T> tryStep(T h, std::vector<T> *error) const {
+        return valuesOfState(rungeKuttaStep(tableau, f, t, h, makeLeaves(y),
+                                            makeLeaves(theta), error));
+    }
+
+    // takes a step to next, the result of a trial step of size h
+    void accept(T h, std::vector<T> next) {
+        steps.push_back(h);
+        t += h;
+        y = std::move(next);
+        if (steps.size() % checkpointInterval == 0) {
+            checkpoints.push_back(y);
+        }
+    }
+
+    // d y_i / d y0_j for j < n, and d y_i / d theta_(j - n) after that
+    T get(std::size_t i, std::size_t j) {
+        std::call_once(swept, [this]() { sweep(); });
+        return jacobian[i * (y.size() + theta.size()) + j];
+    }
+
+private:
+    void sweep() {
+        std::size_t n = y.size();
+        std::size_t p = theta.size();
+        // row i holds the adjoint of y_i's final value, and accumulates the
+        // derivatives wrt the parameters
+        jacobian.assign(n * (n + p), T(0));
+        for (std::size_t i = 0; i < n; i++) {
+            jacobian[i * (n + p) + i] = 1;
+        }
+        std::vector<DiffValue<T>> thetaLeaves = makeLeaves(theta);
+
+        std::vector<T> times{t0};
+        for (T h : steps) {
+            times.push_back(times.back() + h);
+        }
+        // the graphs of one segment's steps, and their inputs
+        std::vector<std::vector<DiffValue<T>>> inputs;
+        std::vector<std::vector<DiffValue<T>>> outputs;
+        for (std::size_t c = checkpoints.size(); c-- > 0;) {
+            std::size_t begin = c * checkpointInterval;
+            std::size_t end =
+                std::min(begin + checkpointInterval, steps.size());
+            std::vector<T> state = checkpoints[c];
+            for (std::size_t s = begin; s < end; s++) {
+                inputs.push_back(makeLeaves(state));
+                outputs.push_back(rungeKuttaStep(tableau, f, times[s],
+                                                 steps[s], inputs.back(),
+                                                 thetaLeaves));
+                state = valuesOfState(outputs.back());
+            }
+            for (std::size_t s = end; s-- > begin;) {
+                pullBack(inputs.back(), outputs.back(), thetaLeaves);
+                inputs.pop_back();
+                outputs.pop_back();
+            }
+        }
+    }
+
+    // replaces each row's adjoint of a step's output by that of its input,
+    // and adds the step's contribution to the parameter derivatives
+    void pullBack(const std::vector<DiffValue<T>> &input,
+                  const std::vector<DiffValue<T>> &output,
+                  const std::vector<DiffValue<T>> &thetaLeaves) {
+        std::size_t n = y.size();
+        std::size_t p = theta.size();
+        // one topological order serves every row, since only the seeds
+        // differ
+        DiffValue<T> root = primitive(T(0), output, std::vector<T>(n, T(0)));
+        std::unordered_map<const Node<T> *, std::size_t> positions;
+        auto order = topologicalOrder(getDiffValueNode(root), &positions);
+        auto adjointOf = [&](const std::vector<AccumulatorTypeT<T>> &adjoints,
+                             const DiffValue<T> &value) {
+            auto itr = positions.find(getDiffValueNode(value).get());
+            return itr != positions.end()
+                       ? static_cast<T>(adjoints[itr->second])
+                       : T(0);
+        };
+        for (std::size_t i = 0; i < n; i++) {
+            T *row = &jacobian[i * (n + p)];
+            std::vector<AccumulatorTypeT<T>> seed(order.size());
+            for (std::size_t k = 0; k < n; k++) {
+                seed[positions.at(getDiffValueNode(output[k]).get())] += row[k];
+            }
+            auto adjoints = accumulateAdjoints(order, positions,
+                                               std::move(seed),
+                                               Summation::Naive);
+            for (std::size_t k = 0; k < n; k++) {
+                row[k] = adjointOf(adjoints, input[k]);
+            }
+            for (std::size_t k = 0; k < p; k++) {
+                row[n + k] += adjointOf(adjoints, thetaLeaves[k]);
+            }
+        }
+    }
+
+    OdeFunction<T> f;
+    const ButcherTableau &tableau;
+    std::vector<T> theta;
+    std::size_t checkpointInterval;
+    T t0;
+    std::vector<T> y;
+    T t;
+    std::vector<T> steps;
+    std::vector<std::vector<T>> checkpoints;
+    std::vector<T> jacobian;
+    std::once_flag swept;
+};
+
+template <typename T>
+std::vector<DiffValue<T>>
+finalState(const std::shared_ptr<OdeIntegration<T>> &integration,
+           const std::vector<DiffValue<T>> &y0,
+           const std::vector<DiffValue<T>> &theta) {
+    std::vector<const DiffValue<T> *> inputs;
+    for (const DiffValue<T> &input : y0) {
+        inputs.push_back(&input);
+    }
+    for (const DiffValue<T> &input : theta) {
+        inputs.push_back(&input);
+    }
+    std::vector<DiffValue<T>> result;
+    result.reserve(y0.size());
+    for (std::size_t i = 0; i < y0.size(); i++) {
+        std::vector<Edge<T>> edges;
+        edges.reserve(inputs.size());
+        for (std::size_t j = 0; j < inputs.size(); j++) {
+            edges.emplace_back(getDiffValueNode(*inputs[j]),
+                               [integration, i, j]() {
+                                   return DiffValue<T>(integration->get(i, j));
+                               });
+        }
+        result.push_back(createDiffValueFromNode(
+            makeNode<T>(integration->state()[i], std::move(edges))));
+    }
+    return result;
+}
+} // namespace impl
+
+/**
+ * Integrates dy/dt = f(t, y, theta) from y(t0) = y0 to t1, with a fixed
+ * number of classic fourth order Runge-Kutta steps, and returns y(t1).
+ *
+ * The result depends on y0 and theta directly. Its derivatives come from
+ * the discrete adjoint of the integration, computed the first time they are
+ * needed, so the graph doesn't grow with the number of steps. Memory for
+ * the states is one checkpoint every checkpointInterval steps, plus one
+ * segment's worth while sweeping backward. The adjoint gives numbers, so
+ * the result's partials are constants (see primitive()).
+ *
+ * Parameters of f must be passed in through theta: the adjoint sweep only
+ * differentiates f wrt the y and theta it is called with, so DiffValues it
+ * captures are treated as constants, and get no derivatives through the
+ * result.
+ */
+template <typename T>
+std::vector<DiffValue<T>>
+integrateRK4(OdeFunction<T> f, const std::vector<DiffValue<T>> &y0,
+             const std::vector<DiffValue<T>> &theta, T t0, T t1,
+             std::size_t steps, std::size_t checkpointInterval = 32) {
+    auto integration = std::make_shared<impl::OdeIntegration<T>>(
+        std::move(f), impl::rk4Tableau(), impl::valuesOfState(y0),
+        impl::valuesOfState(theta), t0, checkpointInterval);
+    T h = (t1 - t0) / static_cast<T>(steps);
+    for (std::size_t s = 0; s < steps; s++) {
+        integration->accept(h, integration->tryStep(h, nullptr));
+    }
+    return impl::finalState(integration, y0, theta);
+}
+
+/**
+ * Integrates dy/dt = f(t, y, theta) from y(t0) = y0 to t1 > t0 with the
+ * adaptive Dormand-Prince 5(4) method, and returns y(t1).
+ *
+ * Steps are accepted when the error estimate, scaled by absoluteTolerance +
+ * relativeTolerance * |y|, has an RMS norm of at most 1. The derivatives
+ * are those of the accepted steps, as for integrateRK4(): the step sizes
+ * themselves, and any DiffValues f captures instead of taking them through
+ * theta, are treated as constants.
+ */
+template <typename T>
+std::vector<DiffValue<T>>
+integrateDormandPrince(OdeFunction<T> f, const std::vector<DiffValue<T>> &y0,
+                       const std::vector<DiffValue<T>> &theta, T t0, T t1,
+                       T relativeTolerance = 1e-6,
+                       T absoluteTolerance = 1e-9,
+                       std::size_t checkpointInterval = 32,
+                       std::size_t maxSteps = 1000000) {
+    if (!(t1 >= t0)) {
+        throw std::invalid_argument("Integration must run forward in time");
+    }
+    auto integration = std::make_shared<impl::OdeIntegration<T>>(
+        std::move(f), impl::dormandPrinceTableau(), impl::valuesOfState(y0),
+        impl::valuesOfState(theta), t0, checkpointInterval);
+    std::size_t n = y0.size();
+    T t = t0;
+    T h = (t1 - t0) / 100;
+    std::vector<T> error;
+    std::size_t attempts = 0;
+    while (t < t1) {
+        if (++attempts > maxSteps) {
+            throw std::runtime_error("Too many ODE steps");
+        }
+        bool last = t + h >= t1;
+        T step = last ? t1 - t : h;
+        std::vector<T> next = integration->tryStep(step, &error);
+        const std::vector<T> &y = integration->state();
+        T norm = 0;
+        for (std::size_t i = 0; i < n; i++) {
+            T scale = absoluteTolerance +
+                      relativeTolerance *
+                          std::max(std::abs(y[i]), std::abs(next[i]));
+            norm += (error[i] / scale) * (error[i] / scale);
+        }
+        norm = n > 0 ? std::sqrt(norm / static_cast<T>(n)) : T(0);
+        T factor = norm > 0 ? T(0.9) * std::pow(norm, T(-0.2)) : T(5);
+        if (norm <= 1) {
+            integration->accept(step, std::move(next));
+            t = last ? t1 : t + step;
+            h = step * std::min(T(5), std::max(T(0.2), factor));
+        } else {
+            h = step * std::max(T(0.2), std::min(T(1), factor));
+            if (t + h == t) {
+                throw std::runtime_error("ODE step size underflow");
+            }
+        }
+    }
+    return impl::finalState(integration, y0, theta);
+}
+
+} // namespace leningrad
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "Derivative.h"
+#include "DiffValue.h"
+#include "VariableRegistry.h"
+
+namespace leningrad {
+
+/**
+ * A function to minimize, of the parameters held by an optimizer.
+ */
+template <typename T>
+using Objective = std::function<DiffValue<T>(const VariableRegistry<T> &)>;
+
+namespace impl {
+// Evaluates an objective at a buffer of parameter values: they are copied
+// into fresh leaves, and the gradient wrt all of them is read out in one
+// sweep that frees the graph as it goes.
+template <typename T> class ObjectiveEvaluator {
+public:
+    T operator()(const Objective<T> &f, const std::vector<T> &x,
+                 std::vector<T> &gradient) {
+        registry.assign(x.data(), x.size());
+        DiffValue<T> value = f(registry);
+        gradient.resize(x.size());
+        registry.gradient(value, gradient.data(), Summation::Naive,
+                          GraphRetention::Release);
+        return value.value();
+    }
+
+private:
+    VariableRegistry<T> registry;
+};
+
+template <typename T>
+T dot(const std::vector<T> &a, const std::vector<T> &b) {
+    T total = 0;
+    for (std::size_t i = 0; i < a.size(); i++) {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+} // namespace impl
+
+/**
+ * Gradient descent with momentum: v = momentum * v - learningRate * grad,
+ * then x += v.
+ */
+template <typename T> class SGD {
+public:
+    SGD(std::vector<T> initial, T learningRate, T momentum = T(0.9))
+        : x(std::move(initial)), velocity(x.size(), T(0)),
+          learningRate(learningRate), momentum(momentum) {}
+
+    const std::vector<T> &parameters() const { return x; }
+
+    /**
+     * Takes one step, and returns the objective before it.
+     */
+    T step(const Objective<T> &f) {
+        T value = evaluate(f, x, gradient);
+        for (std::size_t i = 0; i < x.size(); i++) {
+            velocity[i] = momentum * velocity[i] - learningRate * gradient[i];
+            x[i] += velocity[i];
+        }
+        return value;
+    }
+
+private:
+    std::vector<T> x;
+    std::vector<T> velocity;
+    std::vector<T> gradient;
+    T learningRate;
+    T momentum;
+    impl::ObjectiveEvaluator<T> evaluate;
+};
+
+/**
+ * Adam (Kingma and Ba), with bias-corrected estimates of the first and
+ * second moments of the gradient.
+ */
+template <typename T> class Adam {
+public:
+    explicit Adam(std::vector<T> initial, T learningRate = T(1e-3),
+                  T beta1 = T(0.9), T beta2 = T(0.999), T epsilon = T(1e-8))
+        : x(std::move(initial)), m(x.size(), T(0)), v(x.size(), T(0)),
+          learningRate(learningRate), beta1(beta1), beta2(beta2),
+          epsilon(epsilon) {}
+
+    const std::vector<T> &parameters() const { return x; }
+
+    /**
+     * Takes one step, and returns the objective before it.
+     */
+    T step(const Objective<T> &f) {
+        T value = evaluate(f, x, gradient);
+        steps++;
+        T correction1 = 1 / (1 - std::pow(beta1, static_cast<T>(steps)));
+        T correction2 = 1 / (1 - std::pow(beta2, static_cast<T>(steps)));
+        for (std::size_t i = 0; i < x.size(); i++) {
+            m[i] = beta1 * m[i] + (1 - beta1) * gradient[i];
+            v[i] = beta2 * v[i] + (1 - beta2) * gradient[i] * gradient[i];
+            x[i] -= learningRate * m[i] * correction1 /
+                    (std::sqrt(v[i] * correction2) + epsilon);
+        }
+        return value;
+    }
+
+private:
+    std::vector<T> x;
+    std::vector<T> m;
+    std::vector<T> v;
+    std::vector<T> gradient;
+    T learningRate;
+    T beta1;
+    T beta2;
+    T epsilon;
+    std::size_t steps = 0;
+    impl::ObjectiveEvaluator<T> evaluate;
+};
+
+/**
+ * Limited-memory BFGS: the direction comes from the last history pairs of
+ * parameter and gradient differences, and the step length from a
+ * backtracking line search for sufficient decrease. Each step evaluates
+ * the objective at least once.
+ */
+template <typename T> class LBFGS {
+public:
+    explicit LBFGS(std::vector<T> initial, std::size_t history = 10)
+        : x(std::move(initial)), history(history) {
+        if (history == 0) {
+            throw std::invalid_argument("L-BFGS needs a history of at least 1");
+        }
+    }
+
+    const std::vector<T> &parameters() const { return x; }
+
+    /**
+     * Takes one step, and returns the objective before it. If the line
+     * search finds no decrease, the parameters stay where they are and the
+     * history is cleared.
+     */
+    T step(const Objective<T> &f) {
+        if (!evaluated) {
+            value = evaluate(f, x, gradient);
+            evaluated = true;
+        }
+        T before = value;
+        std::vector<T> direction = searchDirection();
+        T slope = impl::dot(gradient, direction);
+        if (!(slope < 0)) {
+            // not a descent direction, so start over from the gradient
+            pairs.clear();
+            direction = searchDirection();
+            slope = impl::dot(gradient, direction);
+        }
+
+        T alpha = 1;
+        if (pairs.empty()) {
+            alpha = std::min(T(1), 1 / std::sqrt(impl::dot(gradient,
+                                                           gradient)));
+        }
+        std::vector<T> next(x.size());
+        std::vector<T> nextGradient;
+        for (int attempt = 0; attempt < maxBacktracks; attempt++) {
+            for (std::size_t i = 0; i < x.size(); i++) {
+                next[i] = x[i] + alpha * direction[i];
+            }
+            T nextValue = evaluate(f, next, nextGradient);
+            if (nextValue <= value + sufficientDecrease * alpha * slope) {
+                accept(std::move(next), std::move(nextGradient), nextValue);
+                return before;
+            }
+            alpha /= 2;
+        }
+        pairs.clear();
+        return before;
+    }
+
+private:
+    struct Pair {
+        std::vector<T> s;
+        std::vector<T> y;
+        T rho;
+    };
+
+    static constexpr int maxBacktracks = 40;
+    static constexpr T sufficientDecrease = T(1e-4);
+
+    // -H grad, by the two-loop recursion
+    std::vector<T> searchDirection() const {
+        std::vector<T> q(gradient.size());
+        for (std::size_t i = 0; i < q.size(); i++) {
+            q[i] = -gradient[i];
+        }
+        std::vector<T> alphas(pairs.size());
+        for (std::size_t k = pairs.size(); k-- > 0;) {
+            alphas[k] = pairs[k].rho * impl::dot(pairs[k].s, q);
+            for (std::size_t i = 0; i < q.size(); i++) {
+                q[i] -= alphas[k] * pairs[k].y[i];
+            }
+        }
+        if (!pairs.empty()) {
+            const Pair &last = pairs.back();
+            T gamma = 1 / (last.rho * impl::dot(last.y, last.y));
+            for (T &qi : q) {
+                qi *= gamma;
+            }
+        }
+        for (std::size_t k = 0; k < pairs.size(); k++) {
+            T beta = pairs[k].rho * impl::dot(pairs[k].y, q);
+            for (std::size_t i = 0; i < q.size(); i++) {
+                q[i] += (alphas[k] - beta) * pairs[k].s[i];
+            }
+        }
+        return q;
+    }
+
+    void accept(std::vector<T> next, std::vector<T> nextGradient,
+                T nextValue) {
+        Pair pair{std::vector<T>(x.size()), std::vector<T>(x.size()), T(0)};
+        for (std::size_t i = 0; i < x.size(); i++) {
+            pair.s[i] = next[i] - x[i];
+            pair.y[i] = nextGradient[i] - gradient[i];
+        }
+        // skip pairs that would make the inverse Hessian estimate indefinite
+        T sy = impl::dot(pair.s, pair.y);
+        if (sy > 0) {
+            pair.rho = 1 / sy;
+            if (pairs.size() == history) {
+                pairs.pop_front();
+            }
+            pairs.push_back(std::move(pair));
+        }
+        x = std::move(next);
+        gradient = std::move(nextGradient);
+        value = nextValue;
+    }
+
+    std::vector<T> x;
+    std::vector<T> gradient;
+    T value = 0;
+    bool evaluated = false;
+    std::size_t history;
+    std::deque<Pair> pairs;
+    impl::ObjectiveEvaluator<T> evaluate;
+};
+
+} // namespace leningrad
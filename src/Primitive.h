@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "ComputationGraph.h"
+#include "Derivative.h"
+#include "DiffValue.h"
+
+namespace leningrad {
+
+/**
+ * A rule for the partial derivative of a primitive wrt its i-th input, as a
+ * differentiable function of the inputs.
+ */
+template <typename T>
+using PartialRule =
+    std::function<DiffValue<T>(const std::vector<DiffValue<T>> &, std::size_t)>;
+
+namespace impl {
+template <typename T> struct PrimitiveState {
+    std::vector<DiffValue<T>> inputs;
+    std::vector<T> partials;
+    PartialRule<T> rule;
+};
+} // namespace impl
+
+/**
+ * Records a user-defined function as a single node with an edge to each of
+ * its inputs.
+ *
+ * The caller computes the function's value and its partial derivatives wrt
+ * each input. Without a rule, the partials are treated as constants, so
+ * derivatives of order two and higher through this node are zero. If rule
+ * is given, it is used to build each partial as a differentiable value
+ * instead, so higher derivatives are exact too.
+ *
+ * The other nodes recorded from numeric partials, by preaccumulate(),
+ * implicitSolution(), the ODE integrators and LoopBody, have no rule, so
+ * their derivatives are first order only in the same way.
+ */
+template <typename T>
+DiffValue<T> primitive(T value, std::vector<DiffValue<T>> inputs,
+                       std::vector<T> partials, PartialRule<T> rule = nullptr) {
+    if (inputs.size() != partials.size()) {
+        throw std::invalid_argument(
+            "A primitive needs one partial derivative per input");
+    }
+    std::vector<impl::Edge<T>> edges;
+    edges.reserve(inputs.size());
+    for (std::size_t i = 0; i < inputs.size(); i++) {
+        edges.emplace_back(impl::getDiffValueNode(inputs[i]), nullptr,
+                           impl::scalarPartial<T>(), partials[i]);
+    }
+    auto state = std::make_shared<impl::PrimitiveState<T>>(
+        impl::PrimitiveState<T>{rule ? std::move(inputs)
+                                     : std::vector<DiffValue<T>>(),
+                                std::move(partials), std::move(rule)});
+    for (std::size_t i = 0; i < edges.size(); i++) {
+        edges[i].derivativeFn = [state, i]() {
+            return state->rule ? state->rule(state->inputs, i)
+                               : DiffValue<T>(state->partials[i]);
+        };
+    }
+    auto node = impl::makeNode<T>(value, std::move(edges));
+    return impl::createDiffValueFromNode(std::move(node));
+}
+
+/**
+ * Preaccumulates the Jacobian of a local computation: fn is evaluated on
+ * fresh copies of the inputs, differentiated numerically as soon as it
+ * returns, and its result recorded as a single primitive node with edges
+ * directly to the inputs. The intermediate nodes fn created are freed then,
+ * so later sweeps neither store nor visit them.
+ *
+ * This pays off for computations with few inputs and many intermediate
+ * nodes. The result has constant partials, see primitive().
+ *
+ * Everything the result depends on must be passed in through inputs: the
+ * result only has edges to those, so DiffValues fn captures instead are
+ * treated as constants, and get no derivatives through it.
+ */
+template <typename T, typename F>
+DiffValue<T> preaccumulate(const std::vector<DiffValue<T>> &inputs, F &&fn) {
+    std::vector<T> partials(inputs.size());
+    T value;
+    {
+        std::vector<DiffValue<T>> leaves;
+        leaves.reserve(inputs.size());
+        for (const DiffValue<T> &input : inputs) {
+            leaves.emplace_back(input.value());
+        }
+        DiffValue<T> local = fn(std::as_const(leaves));
+        value = local.value();
+        gradient(local, leaves.begin(), leaves.end(), partials.data());
+    }
+    return primitive(value, inputs, std::move(partials));
+}
+
+} // namespace leningrad
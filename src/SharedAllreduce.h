@@ -0,0 +1,251 @@
+#pragma once
+
+// POSIX shared memory is needed to exchange gradients between processes.
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Derivative.h"
+#include "DiffValue.h"
+#include "VariableRegistry.h"
+
+namespace leningrad {
+
+namespace impl {
+/**
+ * A sense-reversing barrier that works between processes when placed in
+ * shared memory, since lock-free atomics are address-free.
+ */
+class SpinBarrier {
+public:
+    void wait(std::uint32_t participants) {
+        std::uint32_t generation = this->generation.load();
+        if (arrived.fetch_add(1) + 1 == participants) {
+            arrived.store(0);
+            this->generation.fetch_add(1);
+            return;
+        }
+        while (this->generation.load() == generation) {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    std::atomic<std::uint32_t> arrived{0};
+    std::atomic<std::uint32_t> generation{0};
+};
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free,
+              "Shared memory synchronization needs lock-free atomics");
+
+struct SharedAllreduceHeader {
+    std::atomic<std::uint32_t> ready;
+    std::atomic<std::uint32_t> attached;
+    std::uint64_t worldSize;
+    std::uint64_t count;
+    std::uint64_t elementSize;
+    SpinBarrier barrier;
+};
+} // namespace impl
+
+/**
+ * Sums flat buffers of T across worker processes on one machine, through a
+ * named POSIX shared memory segment with one slot per worker.
+ *
+ * Every worker constructs an instance with the same name, world size and
+ * element count, and its own rank, then calls allreduce() collectively. The
+ * sum is a reduce-scatter followed by an allgather: each worker copies its
+ * buffer into its slot, sums one 1/worldSize chunk across all slots, and
+ * then gathers the summed chunks of the others. Every worker thus moves
+ * about 3 buffers' worth of data, instead of worldSize for a naive
+ * copy-and-sum. Terms are always added in rank order, so all workers get
+ * bitwise identical results.
+ *
+ * The segment is removed when the last worker detaches. A segment left
+ * behind by a crashed job can be removed with remove().
+ */
+template <typename T> class SharedAllreduce {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Only trivially copyable values can be shared");
+
+public:
+    SharedAllreduce(std::string name, std::size_t rank, std::size_t worldSize,
+                    std::size_t count)
+        : name(std::move(name)), rank(rank), worldSize(worldSize),
+          count(count), bytes(slotsOffset() + worldSize * count * sizeof(T)),
+          header(nullptr), slots(nullptr) {
+        if (worldSize == 0 || rank >= worldSize) {
+            throw std::invalid_argument("Rank must be less than world size");
+        }
+        attach();
+    }
+
+    SharedAllreduce(const SharedAllreduce &) = delete;
+    SharedAllreduce &operator=(const SharedAllreduce &) = delete;
+
+    ~SharedAllreduce() {
+        if (header->attached.fetch_sub(1) == 1) {
+            shm_unlink(name.c_str());
+        }
+        munmap(header, bytes);
+    }
+
+    std::size_t size() const { return count; }
+
+    /**
+     * Replaces data, which holds size() elements, with its sum over all
+     * workers. Blocks until every worker has called it.
+     */
+    void allreduce(T *data) {
+        std::copy(data, data + count, slot(rank));
+        header->barrier.wait(worldSize);
+
+        // reduce-scatter: sum our chunk over all slots, into our own slot
+        std::size_t begin = chunkBegin(rank);
+        std::size_t end = chunkBegin(rank + 1);
+        T *own = slot(rank);
+        for (std::size_t i = begin; i < end; i++) {
+            T total = slot(0)[i];
+            for (std::size_t r = 1; r < worldSize; r++) {
+                total += slot(r)[i];
+            }
+            own[i] = total;
+        }
+        header->barrier.wait(worldSize);
+
+        // allgather the summed chunks
+        for (std::size_t r = 0; r < worldSize; r++) {
+            std::copy(slot(r) + chunkBegin(r), slot(r) + chunkBegin(r + 1),
+                      data + chunkBegin(r));
+        }
+        // nobody may overwrite their slot until everyone has read it
+        header->barrier.wait(worldSize);
+    }
+
+    /**
+     * Writes the numeric derivatives of value wrt every variable in registry
+     * to out, summed over all workers. The registry must hold size()
+     * variables.
+     */
+    void allreduceGradient(const VariableRegistry<T> &registry,
+                           const DiffValue<T> &value, T *out,
+                           GraphRetention retention = GraphRetention::Retain) {
+        if (registry.size() != count) {
+            throw std::invalid_argument(
+                "Registry size doesn't match the shared buffer");
+        }
+        registry.gradient(value, out, Summation::Naive, retention);
+        allreduce(out);
+    }
+
+    /**
+     * Removes the named segment, e.g. one left behind by a crashed job.
+     */
+    static void remove(const std::string &name) { shm_unlink(name.c_str()); }
+
+private:
+    static std::size_t slotsOffset() {
+        std::size_t align = std::max<std::size_t>(alignof(T), 64);
+        return (sizeof(impl::SharedAllreduceHeader) + align - 1) / align *
+               align;
+    }
+
+    T *slot(std::size_t r) const { return slots + r * count; }
+
+    std::size_t chunkBegin(std::size_t r) const {
+        return r * count / worldSize;
+    }
+
+    void attach() {
+        bool created = true;
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0 && errno == EEXIST) {
+            created = false;
+            fd = shm_open(name.c_str(), O_RDWR, 0600);
+        }
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "shm_open " + name);
+        }
+        if (created) {
+            if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+                int error = errno;
+                close(fd);
+                shm_unlink(name.c_str());
+                throw std::system_error(error, std::generic_category(),
+                                        "ftruncate " + name);
+            }
+        } else {
+            // wait for the creator to size the segment
+            struct stat info {};
+            while (fstat(fd, &info) == 0 && info.st_size == 0) {
+                std::this_thread::yield();
+            }
+            if (static_cast<std::size_t>(info.st_size) != bytes) {
+                close(fd);
+                throw std::invalid_argument(
+                    "Shared segment " + name +
+                    " was created with a different layout");
+            }
+        }
+        void *memory =
+            mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        int error = errno;
+        close(fd);
+        if (memory == MAP_FAILED) {
+            throw std::system_error(error, std::generic_category(),
+                                    "mmap " + name);
+        }
+        header = static_cast<impl::SharedAllreduceHeader *>(memory);
+        slots = reinterpret_cast<T *>(static_cast<char *>(memory) +
+                                      slotsOffset());
+
+        if (created) {
+            // the segment starts zeroed, which is a valid state for the
+            // atomics and the barrier
+            header->worldSize = worldSize;
+            header->count = count;
+            header->elementSize = sizeof(T);
+            header->ready.store(1);
+        } else {
+            // sizes can agree by accident, so check the whole layout
+            while (header->ready.load() == 0) {
+                std::this_thread::yield();
+            }
+            if (header->worldSize != worldSize || header->count != count ||
+                header->elementSize != sizeof(T)) {
+                munmap(memory, bytes);
+                throw std::invalid_argument(
+                    "Shared segment " + name +
+                    " was created with a different layout");
+            }
+        }
+        header->attached.fetch_add(1);
+    }
+
+    std::string name;
+    std::size_t rank;
+    std::size_t worldSize;
+    std::size_t count;
+    std::size_t bytes;
+    impl::SharedAllreduceHeader *header;
+    T *slots;
+};
+
+} // namespace leningrad
+
+#endif
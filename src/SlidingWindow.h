@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "ComputationGraph.h"
+#include "DiffValue.h"
+
+namespace leningrad {
+
+/**
+ * Truncated backpropagation through a stream: keeps the graph of only the
+ * last length() steps of a recurrence.
+ *
+ * The state of the recurrence is pushed after every step. Once it is more
+ * than length() steps old, its nodes are cut into constant leaves (their
+ * edges are released, as with GraphRetention::Release), so derivatives stop
+ * there and everything only reachable through them is freed. Memory and the
+ * cost of differentiating the latest step then stay constant however long
+ * the stream gets, as long as nothing else holds on to older parts of the
+ * graph (e.g. a loss summed over the whole stream).
+ *
+ * The nodes themselves are cut, so every graph built on them sees them as
+ * constants. A window must only be pushed to while no other thread is
+ * using the graph.
+ */
+template <typename T> class SlidingWindow {
+public:
+    explicit SlidingWindow(std::size_t length) : windowLength(length) {
+        if (length == 0) {
+            throw std::invalid_argument("Window length must be positive");
+        }
+    }
+
+    /**
+     * Records the state after one more step, and cuts the state recorded
+     * length() steps before it.
+     */
+    void push(const std::vector<DiffValue<T>> &state) {
+        std::vector<impl::NodePtr<T>> nodes;
+        nodes.reserve(state.size());
+        for (const DiffValue<T> &value : state) {
+            nodes.push_back(impl::getDiffValueNode(value));
+        }
+        steps.push_back(std::move(nodes));
+        if (steps.size() > windowLength) {
+            cut(steps.front());
+            steps.pop_front();
+        }
+    }
+
+    void push(const DiffValue<T> &state) {
+        push(std::vector<DiffValue<T>>{state});
+    }
+
+    std::size_t length() const { return windowLength; }
+
+    // the number of steps recorded and not cut yet
+    std::size_t size() const { return steps.size(); }
+
+    /**
+     * Cuts every state still in the window, e.g. at the end of a sequence.
+     */
+    void truncate() {
+        for (auto &nodes : steps) {
+            cut(nodes);
+        }
+        steps.clear();
+    }
+
+private:
+    static void cut(std::vector<impl::NodePtr<T>> &nodes) {
+        for (auto &node : nodes) {
+            node->releaseEdges();
+        }
+    }
+
+    std::size_t windowLength;
+    std::deque<std::vector<impl::NodePtr<T>>> steps;
+};
+
+} // namespace leningrad
@@ -0,0 +1,423 @@
+#pragma once
+
+// Spilling needs POSIX files and memory mapping.
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ComputationGraph.h"
+#include "Derivative.h"
+#include "DiffValue.h"
+
+namespace leningrad {
+
+namespace impl {
+/**
+ * An append-only temporary file, which is unlinked as soon as it is created
+ * so it goes away with the process, and can be mapped for reading.
+ */
+class SpillFile {
+public:
+    explicit SpillFile(const std::string &directory) : fd(-1), size(0) {
+        std::string path = directory + "/leningrad-spill-XXXXXX";
+        fd = mkstemp(path.data());
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "mkstemp " + path);
+        }
+        unlink(path.c_str());
+        buffer.reserve(bufferSize);
+    }
+
+    SpillFile(const SpillFile &) = delete;
+    SpillFile &operator=(const SpillFile &) = delete;
+
+    ~SpillFile() { close(fd); }
+
+    void append(const void *data, std::size_t bytes) {
+        const char *begin = static_cast<const char *>(data);
+        if (buffer.size() + bytes > bufferSize) {
+            flush();
+        }
+        buffer.insert(buffer.end(), begin, begin + bytes);
+    }
+
+    void flush() {
+        std::size_t written = 0;
+        while (written < buffer.size()) {
+            ssize_t n =
+                write(fd, buffer.data() + written, buffer.size() - written);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(),
+                                        "write spill file");
+            }
+            written += static_cast<std::size_t>(n);
+        }
+        size += buffer.size();
+        buffer.clear();
+    }
+
+    /**
+     * Everything appended so far, mapped read-only for the lifetime of the
+     * returned object.
+     */
+    class Mapping {
+    public:
+        Mapping(int fd, std::size_t size) : data(nullptr), size(size) {
+            if (size == 0) {
+                return;
+            }
+            void *memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (memory == MAP_FAILED) {
+                throw std::system_error(errno, std::generic_category(),
+                                        "mmap spill file");
+            }
+            data = static_cast<const char *>(memory);
+        }
+
+        Mapping(const Mapping &) = delete;
+        Mapping &operator=(const Mapping &) = delete;
+
+        ~Mapping() {
+            if (data) {
+                munmap(const_cast<char *>(data), size);
+            }
+        }
+
+        const char *data;
+        std::size_t size;
+    };
+
+    Mapping map() {
+        flush();
+        return Mapping(fd, size);
+    }
+
+    std::size_t bytes() const { return size + buffer.size(); }
+
+private:
+    static constexpr std::size_t bufferSize = 1 << 20;
+
+    int fd;
+    std::size_t size;
+    std::vector<char> buffer;
+};
+} // namespace impl
+
+template <typename T, typename Acc> class TapeGradient;
+
+/**
+ * Bounds the memory taken by graph nodes of type T created on this thread
+ * while the tape exists.
+ *
+ * The tape keeps track of the nodes in creation order. Once their estimated
+ * size exceeds the budget, the oldest are spilled: their numeric partials
+ * are appended to a temporary file, and their edges (with everything only
+ * reachable through them) are released. The tape's gradient() sweeps what is
+ * still in memory, then streams the file back in reverse, which visits
+ * every spilled node after all the nodes that depend on it.
+ *
+ * Spilled nodes act as constants everywhere else, so graphs built under a
+ * tape must be differentiated with its gradient(), which computes first
+ * derivatives only. Spilling happens on the creating thread, and nodes
+ * created by other threads while the tape exists aren't tracked, and must
+ * not take part in its graphs.
+ */
+template <typename T>
+class SpillTape : private impl::NodeObserver<T> {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Only trivially copyable values can be spilled");
+
+public:
+    explicit SpillTape(std::size_t budgetBytes,
+                       const std::string &directory = "/tmp")
+        : budget(budgetBytes), file(directory),
+          previous(impl::currentNodeObserver<T>()) {
+        impl::currentNodeObserver<T>() = this;
+    }
+
+    SpillTape(const SpillTape &) = delete;
+    SpillTape &operator=(const SpillTape &) = delete;
+
+    ~SpillTape() override { impl::currentNodeObserver<T>() = previous; }
+
+    /**
+     * The estimated size of the tracked nodes still in memory.
+     */
+    std::size_t residentBytes() const { return resident; }
+
+    /**
+     * The largest residentBytes() has been.
+     */
+    std::size_t peakResidentBytes() const { return peak; }
+
+    std::size_t spilledNodes() const { return spilledCount; }
+
+    std::size_t spilledBytes() const { return file.bytes(); }
+
+    /**
+     * Computes the numeric first derivatives of value wrt everything it
+     * depends on, including through spilled nodes. The result can only be
+     * queried while the tape exists.
+     */
+    template <typename Acc = AccumulatorTypeT<T>>
+    TapeGradient<T, Acc> gradient(const DiffValue<T> &value);
+
+private:
+    // suspends tracking, e.g. while derivative closures create nodes
+    class Pause {
+    public:
+        explicit Pause(SpillTape &tape)
+            : observer(impl::currentNodeObserver<T>()) {
+            impl::currentNodeObserver<T>() = tape.previous;
+        }
+
+        ~Pause() { impl::currentNodeObserver<T>() = observer; }
+
+    private:
+        impl::NodeObserver<T> *observer;
+    };
+
+    static std::size_t estimate(const impl::Node<T> &node) {
+        // the node, its control block, and each edge with a small closure
+        return sizeof(impl::Node<T>) + 32 +
+               node.edges.capacity() * (sizeof(impl::Edge<T>) + 16);
+    }
+
+    void nodeCreated(const impl::NodePtr<T> &node) override {
+        // a node that had an id may have died and left its address to this
+        // one
+        ids.erase(node.get());
+        std::size_t bytes = estimate(*node);
+        tracked.emplace_back(node, bytes);
+        resident += bytes;
+        peak = std::max(peak, resident);
+        if (resident > budget) {
+            // spill down to half the budget, so spills come in batches
+            Pause pause(*this);
+            while (resident > budget / 2 && !tracked.empty()) {
+                spillOldest();
+            }
+        }
+    }
+
+    std::uint64_t idOf(const impl::NodePtr<T> &node) {
+        auto [itr, added] = ids.emplace(node.get(), nextId);
+        if (added) {
+            // a leaf, or a node created before the tape, which is kept so
+            // its adjoint can be propagated through its edges in memory
+            nextId++;
+            if (!node->edges.empty()) {
+                externals.push_back(node);
+            }
+        }
+        return itr->second;
+    }
+
+    const std::uint64_t *findId(const impl::Node<T> *node) const {
+        auto itr = ids.find(node);
+        return itr != ids.end() ? &itr->second : nullptr;
+    }
+
+    void spillOldest() {
+        auto [node, bytes] = std::move(tracked.front());
+        tracked.pop_front();
+        resident -= bytes;
+        if (node.use_count() == 1 || node->edges.empty()) {
+            // nothing refers to it anymore, or there's nothing to record
+            return;
+        }
+        for (const impl::Edge<T> &edge : node->edges) {
+            std::uint64_t child = idOf(edge.to);
+            T partial = impl::edgePartial<T>(*node, edge);
+            file.append(&child, sizeof(child));
+            file.append(&partial, sizeof(partial));
+        }
+        std::uint64_t id = nextId++;
+        ids[node.get()] = id;
+        std::uint64_t trailer[2] = {id, node->edges.size()};
+        file.append(trailer, sizeof(trailer));
+        std::vector<impl::NodePtr<T>> children;
+        children.reserve(node->edges.size());
+        for (const impl::Edge<T> &edge : node->edges) {
+            children.push_back(edge.to);
+        }
+        node->releaseEdges();
+        // children only this node referred to die here, so their ids will
+        // not be looked up again
+        std::sort(children.begin(), children.end(),
+                  [](const auto &a, const auto &b) {
+                      return std::less<>()(a.get(), b.get());
+                  });
+        children.erase(std::unique(children.begin(), children.end()),
+                       children.end());
+        for (const impl::NodePtr<T> &child : children) {
+            if (child.use_count() == 1) {
+                ids.erase(child.get());
+            }
+        }
+        spilledCount++;
+    }
+
+    template <typename, typename> friend class TapeGradient;
+
+    std::size_t budget;
+    impl::SpillFile file;
+    impl::NodeObserver<T> *previous;
+    std::deque<std::pair<impl::NodePtr<T>, std::size_t>> tracked;
+    std::vector<impl::NodePtr<T>> externals;
+    // the id of each node that has one: spilled nodes, and the nodes they
+    // have edges to
+    std::unordered_map<const impl::Node<T> *, std::uint64_t> ids;
+    std::size_t resident = 0;
+    std::size_t peak = 0;
+    std::size_t spilledCount = 0;
+    std::uint64_t nextId = 0;
+};
+
+/**
+ * Numeric first derivatives of a value, as computed by SpillTape::gradient().
+ */
+template <typename T, typename Acc> class TapeGradient {
+public:
+    Acc wrt(const DiffValue<T> &value) const {
+        const impl::Node<T> *node = impl::getDiffValueNode(value).get();
+        if (const std::uint64_t *id = tape->findId(node)) {
+            return *id < spilled.size() ? spilled[*id] : Acc(0);
+        }
+        auto itr = resident.find(node);
+        return itr != resident.end() ? itr->second : Acc(0);
+    }
+
+private:
+    explicit TapeGradient(const SpillTape<T> *tape) : tape(tape) {}
+
+    void addResident(const std::vector<impl::NodePtr<T>> &order,
+                     const std::vector<Acc> &adjoints) {
+        for (std::size_t i = 0; i < order.size(); i++) {
+            if (adjoints[i] == Acc(0)) {
+                continue;
+            }
+            if (const std::uint64_t *id = tape->findId(order[i].get())) {
+                spilled[*id] += adjoints[i];
+            } else {
+                resident[order[i].get()] += adjoints[i];
+                nodes.push_back(order[i]);
+            }
+        }
+    }
+
+    friend class SpillTape<T>;
+
+    const SpillTape<T> *tape;
+    std::vector<Acc> spilled;
+    std::unordered_map<const impl::Node<T> *, Acc> resident;
+    // keeps the resident nodes alive, so their addresses stay valid
+    std::vector<impl::NodePtr<T>> nodes;
+};
+
+template <typename T>
+template <typename Acc>
+TapeGradient<T, Acc> SpillTape<T>::gradient(const DiffValue<T> &value) {
+    Pause pause(*this);
+    TapeGradient<T, Acc> result(this);
+    result.spilled.assign(nextId, Acc(0));
+
+    // the part of the graph still in memory, where spilled nodes are leaves
+    {
+        std::unordered_map<const impl::Node<T> *, std::size_t> positions;
+        auto order = impl::topologicalOrder(impl::getDiffValueNode(value),
+                                            &positions);
+        std::vector<Acc> seed(order.size(), Acc(0));
+        seed[0] = Acc(1);
+        auto adjoints = impl::accumulateAdjoints<Acc>(
+            order, positions, std::move(seed), Summation::Naive);
+        result.addResident(order, adjoints);
+    }
+
+    // the spilled records, newest first, where external nodes only collect
+    // their adjoints, to be propagated in memory afterwards
+    std::unordered_map<std::uint64_t, std::size_t> externalIndex;
+    for (std::size_t k = 0; k < externals.size(); k++) {
+        externalIndex.emplace(*findId(externals[k].get()), k);
+    }
+    std::vector<Acc> externalSeeds(externals.size(), Acc(0));
+    {
+        auto mapping = file.map();
+        constexpr std::size_t edgeBytes = sizeof(std::uint64_t) + sizeof(T);
+        std::size_t end = mapping.size;
+        while (end > 0) {
+            std::uint64_t trailer[2];
+            std::memcpy(trailer, mapping.data + end - sizeof(trailer),
+                        sizeof(trailer));
+            std::size_t begin = end - sizeof(trailer) - trailer[1] * edgeBytes;
+            Acc adjoint = result.spilled[trailer[0]];
+            for (std::size_t e = 0; adjoint != Acc(0) && e < trailer[1]; e++) {
+                std::uint64_t child;
+                T partial;
+                const char *record = mapping.data + begin + e * edgeBytes;
+                std::memcpy(&child, record, sizeof(child));
+                std::memcpy(&partial, record + sizeof(child), sizeof(partial));
+                Acc term = static_cast<Acc>(partial) * adjoint;
+                auto external = externalIndex.find(child);
+                if (external != externalIndex.end()) {
+                    externalSeeds[external->second] += term;
+                } else {
+                    result.spilled[child] += term;
+                }
+            }
+            end = begin;
+        }
+    }
+
+    // propagate what reached the external nodes, seeding each with its
+    // adjoint below a root that contributes nothing itself
+    std::vector<impl::Edge<T>> edges;
+    for (std::size_t k = 0; k < externals.size(); k++) {
+        if (externalSeeds[k] != Acc(0)) {
+            edges.emplace_back(externals[k], []() { return DiffValue<T>(1); },
+                               impl::scalarPartial<T>(), T(1));
+        }
+    }
+    if (!edges.empty()) {
+        auto root = impl::makeNode<T>(T(0), std::move(edges));
+        std::unordered_map<const impl::Node<T> *, std::size_t> positions;
+        auto order = impl::topologicalOrder(root, &positions);
+        std::vector<Acc> seed(order.size(), Acc(0));
+        for (std::size_t k = 0; k < externals.size(); k++) {
+            auto itr = positions.find(externals[k].get());
+            if (itr != positions.end()) {
+                seed[itr->second] = externalSeeds[k];
+            }
+        }
+        auto adjoints = impl::accumulateAdjoints<Acc>(
+            order, positions, std::move(seed), Summation::Naive);
+        adjoints[0] = Acc(0);
+        result.addResident(order, adjoints);
+    }
+    return result;
+}
+
+} // namespace leningrad
+
+#endif
@@ -0,0 +1,437 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Compile-time differentiation of fixed expressions.
+ *
+ * Expressions are built from the placeholders Var<0>, Var<1>, ... with the
+ * same operators and function names as DiffValue, and are differentiated by
+ * diff<I>(), which forms the derivative as a new expression type at compile
+ * time. Evaluating an expression compiles down to straight-line arithmetic,
+ * with no graph and no allocation:
+ *
+ *     using namespace leningrad::expr;
+ *     constexpr Var<0> x;
+ *     constexpr Var<1> y;
+ *     constexpr auto f = sin(x * y) + square(x);
+ *     double dfdx = diff<0>(f)(1.0, 2.0);
+ *     double d2fdxdy = diff<0, 1>(f)(1.0, 2.0);
+ *
+ * Trivial subexpressions (adding zero, multiplying by zero or one, etc.) are
+ * simplified away as the derivative is formed, so higher derivatives stay
+ * small.
+ */
+namespace leningrad::expr {
+
+template <typename E> struct Expression {
+    template <typename... Args> constexpr auto operator()(Args... args) const {
+        using T = std::common_type_t<Args...>;
+        std::array<T, sizeof...(Args)> values{static_cast<T>(args)...};
+        return static_cast<const E &>(*this).eval(values);
+    }
+};
+
+template <typename E>
+constexpr bool isExpression = std::is_base_of_v<Expression<E>, E>;
+
+template <std::size_t I> struct Var : Expression<Var<I>> {
+    template <typename T, std::size_t N>
+    constexpr T eval(const std::array<T, N> &x) const {
+        static_assert(I < N, "Not enough arguments for this expression");
+        return x[I];
+    }
+};
+
+template <long long N> struct Int : Expression<Int<N>> {
+    static constexpr long long value = N;
+
+    template <typename T, std::size_t M>
+    constexpr T eval(const std::array<T, M> &) const {
+        return static_cast<T>(N);
+    }
+};
+
+using Zero = Int<0>;
+using One = Int<1>;
+
+struct Literal : Expression<Literal> {
+    constexpr explicit Literal(double value) : value(value) {}
+
+    template <typename T, std::size_t N>
+    constexpr T eval(const std::array<T, N> &) const {
+        return static_cast<T>(value);
+    }
+
+    double value;
+};
+
+template <typename E> struct IsInt : std::false_type {};
+template <long long N> struct IsInt<Int<N>> : std::true_type {};
+
+template <typename E> struct IsNeg : std::false_type {};
+
+template <typename E, long long N> constexpr bool isInt = false;
+template <long long M, long long N> constexpr bool isInt<Int<M>, N> = M == N;
+
+template <typename E> constexpr auto toExpression(const E &e) {
+    if constexpr (isExpression<E>) {
+        return e;
+    } else {
+        static_assert(std::is_arithmetic_v<E>);
+        return Literal(static_cast<double>(e));
+    }
+}
+
+template <typename L, typename R>
+using EnableBinary =
+    std::enable_if_t<(isExpression<L> || isExpression<R>) &&
+                     (isExpression<L> || std::is_arithmetic_v<L>) &&
+                     (isExpression<R> || std::is_arithmetic_v<R>)>;
+
+#define LENINGRAD_EXPR_BINARY_NODE(Name, op)                                   \
+    template <typename L, typename R> struct Name : Expression<Name<L, R>> {   \
+        constexpr Name(L lhs, R rhs) : lhs(lhs), rhs(rhs) {}                   \
+                                                                               \
+        template <typename T, std::size_t N>                                   \
+        constexpr T eval(const std::array<T, N> &x) const {                    \
+            return lhs.eval(x) op rhs.eval(x);                                 \
+        }                                                                      \
+                                                                               \
+        L lhs;                                                                 \
+        R rhs;                                                                 \
+    };
+
+LENINGRAD_EXPR_BINARY_NODE(Add, +)
+LENINGRAD_EXPR_BINARY_NODE(Sub, -)
+LENINGRAD_EXPR_BINARY_NODE(Mul, *)
+LENINGRAD_EXPR_BINARY_NODE(Div, /)
+
+#undef LENINGRAD_EXPR_BINARY_NODE
+
+template <typename E> struct Neg : Expression<Neg<E>> {
+    constexpr explicit Neg(E arg) : arg(arg) {}
+
+    template <typename T, std::size_t N>
+    constexpr T eval(const std::array<T, N> &x) const {
+        return -arg.eval(x);
+    }
+
+    E arg;
+};
+
+template <typename E> struct IsNeg<Neg<E>> : std::true_type {};
+
+constexpr long long intPow(long long base, long long exponent) {
+    long long result = 1;
+    for (long long i = 0; i < exponent; i++) {
+        result *= base;
+    }
+    return result;
+}
+
+template <typename E, long long P> struct PowInt : Expression<PowInt<E, P>> {
+    constexpr explicit PowInt(E arg) : arg(arg) {}
+
+    template <typename T, std::size_t N>
+    constexpr T eval(const std::array<T, N> &x) const {
+        T base = arg.eval(x);
+        T result = 1;
+        for (long long i = 0; i < (P < 0 ? -P : P); i++) {
+            result *= base;
+        }
+        return P < 0 ? 1 / result : result;
+    }
+
+    E arg;
+};
+
+template <typename E> struct Pow : Expression<Pow<E>> {
+    constexpr Pow(E arg, double exponent) : arg(arg), exponent(exponent) {}
+
+    template <typename T, std::size_t N>
+    T eval(const std::array<T, N> &x) const {
+        return std::pow(arg.eval(x), static_cast<T>(exponent));
+    }
+
+    E arg;
+    double exponent;
+};
+
+#define LENINGRAD_EXPR_UNARY_NODE(Name, fn)                                    \
+    template <typename E> struct Name : Expression<Name<E>> {                  \
+        constexpr explicit Name(E arg) : arg(arg) {}                           \
+                                                                               \
+        template <typename T, std::size_t N>                                   \
+        T eval(const std::array<T, N> &x) const {                              \
+            return std::fn(arg.eval(x));                                       \
+        }                                                                      \
+                                                                               \
+        E arg;                                                                 \
+    };
+
+LENINGRAD_EXPR_UNARY_NODE(Sin, sin)
+LENINGRAD_EXPR_UNARY_NODE(Cos, cos)
+LENINGRAD_EXPR_UNARY_NODE(Tan, tan)
+LENINGRAD_EXPR_UNARY_NODE(Exp, exp)
+LENINGRAD_EXPR_UNARY_NODE(Log, log)
+LENINGRAD_EXPR_UNARY_NODE(Sqrt, sqrt)
+LENINGRAD_EXPR_UNARY_NODE(Sinh, sinh)
+LENINGRAD_EXPR_UNARY_NODE(Cosh, cosh)
+LENINGRAD_EXPR_UNARY_NODE(Tanh, tanh)
+
+#undef LENINGRAD_EXPR_UNARY_NODE
+
+// Operators and functions, simplifying constant subexpressions as they go
+
+template <typename E, typename = std::enable_if_t<isExpression<E>>>
+constexpr auto operator-(const E &e) {
+    if constexpr (IsInt<E>::value) {
+        return Int<-E::value>();
+    } else if constexpr (IsNeg<E>::value) {
+        return e.arg;
+    } else {
+        return Neg<E>(e);
+    }
+}
+
+template <typename L, typename R, typename = EnableBinary<L, R>>
+constexpr auto operator+(const L &l, const R &r) {
+    auto lhs = toExpression(l);
+    auto rhs = toExpression(r);
+    using LE = decltype(lhs);
+    using RE = decltype(rhs);
+    if constexpr (isInt<LE, 0>) {
+        return rhs;
+    } else if constexpr (isInt<RE, 0>) {
+        return lhs;
+    } else if constexpr (IsInt<LE>::value && IsInt<RE>::value) {
+        return Int<LE::value + RE::value>();
+    } else {
+        return Add<LE, RE>(lhs, rhs);
+    }
+}
+
+template <typename L, typename R, typename = EnableBinary<L, R>>
+constexpr auto operator-(const L &l, const R &r) {
+    auto lhs = toExpression(l);
+    auto rhs = toExpression(r);
+    using LE = decltype(lhs);
+    using RE = decltype(rhs);
+    if constexpr (isInt<RE, 0>) {
+        return lhs;
+    } else if constexpr (isInt<LE, 0>) {
+        return -rhs;
+    } else if constexpr (IsInt<LE>::value && IsInt<RE>::value) {
+        return Int<LE::value - RE::value>();
+    } else {
+        return Sub<LE, RE>(lhs, rhs);
+    }
+}
+
+template <typename L, typename R, typename = EnableBinary<L, R>>
+constexpr auto operator*(const L &l, const R &r) {
+    auto lhs = toExpression(l);
+    auto rhs = toExpression(r);
+    using LE = decltype(lhs);
+    using RE = decltype(rhs);
+    if constexpr (isInt<LE, 0> || isInt<RE, 0>) {
+        return Zero();
+    } else if constexpr (isInt<LE, 1>) {
+        return rhs;
+    } else if constexpr (isInt<RE, 1>) {
+        return lhs;
+    } else if constexpr (isInt<LE, -1>) {
+        return -rhs;
+    } else if constexpr (isInt<RE, -1>) {
+        return -lhs;
+    } else if constexpr (IsInt<LE>::value && IsInt<RE>::value) {
+        return Int<LE::value * RE::value>();
+    } else {
+        return Mul<LE, RE>(lhs, rhs);
+    }
+}
+
+template <typename L, typename R, typename = EnableBinary<L, R>>
+constexpr auto operator/(const L &l, const R &r) {
+    auto lhs = toExpression(l);
+    auto rhs = toExpression(r);
+    using LE = decltype(lhs);
+    using RE = decltype(rhs);
+    if constexpr (isInt<LE, 0>) {
+        return Zero();
+    } else if constexpr (isInt<RE, 1>) {
+        return lhs;
+    } else {
+        return Div<LE, RE>(lhs, rhs);
+    }
+}
+
+template <long long P, typename E> constexpr auto pow(const E &e) {
+    if constexpr (P == 0) {
+        return One();
+    } else if constexpr (P == 1) {
+        return e;
+    } else if constexpr (IsInt<E>::value && P > 0) {
+        return Int<intPow(E::value, P)>();
+    } else {
+        return PowInt<E, P>(e);
+    }
+}
+
+template <typename E, typename = std::enable_if_t<isExpression<E>>>
+constexpr auto pow(const E &e, double exponent) {
+    return Pow<E>(e, exponent);
+}
+
+template <typename E> constexpr auto square(const E &e) { return pow<2>(e); }
+
+#define LENINGRAD_EXPR_UNARY_FN(name, Name)                                    \
+    template <typename E, typename = std::enable_if_t<isExpression<E>>>       \
+    constexpr auto name(const E &e) {                                          \
+        return Name<E>(e);                                                     \
+    }
+
+LENINGRAD_EXPR_UNARY_FN(sin, Sin)
+LENINGRAD_EXPR_UNARY_FN(cos, Cos)
+LENINGRAD_EXPR_UNARY_FN(tan, Tan)
+LENINGRAD_EXPR_UNARY_FN(exp, Exp)
+LENINGRAD_EXPR_UNARY_FN(log, Log)
+LENINGRAD_EXPR_UNARY_FN(sqrt, Sqrt)
+LENINGRAD_EXPR_UNARY_FN(sinh, Sinh)
+LENINGRAD_EXPR_UNARY_FN(cosh, Cosh)
+LENINGRAD_EXPR_UNARY_FN(tanh, Tanh)
+
+#undef LENINGRAD_EXPR_UNARY_FN
+
+// Derivative rules
+
+template <std::size_t I, std::size_t J> constexpr auto derivative(Var<J>) {
+    if constexpr (I == J) {
+        return One();
+    } else {
+        return Zero();
+    }
+}
+
+template <std::size_t I, long long N> constexpr auto derivative(Int<N>) {
+    return Zero();
+}
+
+template <std::size_t I> constexpr auto derivative(Literal) { return Zero(); }
+
+template <std::size_t I, typename L, typename R>
+constexpr auto derivative(const Add<L, R> &e) {
+    return derivative<I>(e.lhs) + derivative<I>(e.rhs);
+}
+
+template <std::size_t I, typename L, typename R>
+constexpr auto derivative(const Sub<L, R> &e) {
+    return derivative<I>(e.lhs) - derivative<I>(e.rhs);
+}
+
+template <std::size_t I, typename L, typename R>
+constexpr auto derivative(const Mul<L, R> &e) {
+    return derivative<I>(e.lhs) * e.rhs + e.lhs * derivative<I>(e.rhs);
+}
+
+template <std::size_t I, typename L, typename R>
+constexpr auto derivative(const Div<L, R> &e) {
+    return derivative<I>(e.lhs) / e.rhs -
+           e.lhs * derivative<I>(e.rhs) / square(e.rhs);
+}
+
+template <std::size_t I, typename E>
+constexpr auto derivative(const Neg<E> &e) {
+    return -derivative<I>(e.arg);
+}
+
+template <std::size_t I, typename E, long long P>
+constexpr auto derivative(const PowInt<E, P> &e) {
+    return Int<P>() * pow<P - 1>(e.arg) * derivative<I>(e.arg);
+}
+
+template <std::size_t I, typename E> constexpr auto derivative(const Pow<E> &e) {
+    return Literal(e.exponent) * pow(e.arg, e.exponent - 1) *
+           derivative<I>(e.arg);
+}
+
+template <std::size_t I, typename E> constexpr auto derivative(const Sin<E> &e) {
+    return cos(e.arg) * derivative<I>(e.arg);
+}
+
+template <std::size_t I, typename E> constexpr auto derivative(const Cos<E> &e) {
+    return -sin(e.arg) * derivative<I>(e.arg);
+}
+
+template <std::size_t I, typename E> constexpr auto derivative(const Tan<E> &e) {
+    return (One() + square(e)) * derivative<I>(e.arg);
+}
+
+template <std::size_t I, typename E> constexpr auto derivative(const Exp<E> &e) {
+    return e * derivative<I>(e.arg);
+}
+
+template <std::size_t I, typename E> constexpr auto derivative(const Log<E> &e) {
+    return derivative<I>(e.arg) / e.arg;
+}
+
+template <std::size_t I, typename E>
+constexpr auto derivative(const Sqrt<E> &e) {
+    return derivative<I>(e.arg) / (Int<2>() * e);
+}
+
+template <std::size_t I, typename E>
+constexpr auto derivative(const Sinh<E> &e) {
+    return cosh(e.arg) * derivative<I>(e.arg);
+}
+
+template <std::size_t I, typename E>
+constexpr auto derivative(const Cosh<E> &e) {
+    return sinh(e.arg) * derivative<I>(e.arg);
+}
+
+template <std::size_t I, typename E>
+constexpr auto derivative(const Tanh<E> &e) {
+    return (One() - square(e)) * derivative<I>(e.arg);
+}
+
+/**
+ * The derivative of e wrt Var<I>, then wrt Var<Is>... in turn.
+ */
+template <std::size_t I, std::size_t... Is, typename E>
+constexpr auto diff(const E &e) {
+    if constexpr (sizeof...(Is) == 0) {
+        return derivative<I>(e);
+    } else {
+        return diff<Is...>(derivative<I>(e));
+    }
+}
+
+template <std::size_t N, typename E> struct Gradient {
+    template <typename... Args> auto operator()(Args... args) const {
+        return evaluate(std::make_index_sequence<N>(), args...);
+    }
+
+    template <std::size_t... Is, typename... Args>
+    auto evaluate(std::index_sequence<Is...>, Args... args) const {
+        using T = std::common_type_t<Args...>;
+        return std::array<T, N>{diff<Is>(e)(args...)...};
+    }
+
+    E e;
+};
+
+/**
+ * The first derivatives of e wrt Var<0>, ..., Var<N - 1>. Evaluating the
+ * result at a point gives them as an std::array.
+ */
+template <std::size_t N, typename E> constexpr auto gradient(const E &e) {
+    return Gradient<N, E>{e};
+}
+
+} // namespace leningrad::expr
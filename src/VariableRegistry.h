@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Derivative.h"
+#include "DiffValue.h"
+
+namespace leningrad {
+
+/**
+ * A set of leaf variables with stable integer ids (their index in the
+ * registry). Gradients wrt all of them can be written into a contiguous
+ * buffer in one sweep.
+ */
+template <typename T> class VariableRegistry {
+public:
+    VariableRegistry() : variables(), ids() {}
+
+    /**
+     * Creates a new leaf variable, with the next id.
+     */
+    DiffValue<T> add(T value) {
+        variables.emplace_back(value);
+        ids.emplace(impl::getDiffValueNode(variables.back()).get(),
+                    variables.size() - 1);
+        return variables.back();
+    }
+
+    /**
+     * Replaces the variables with count new leaves holding the given values,
+     * with ids 0 to count - 1. The old variables are no longer part of the
+     * registry, even if they are still in use.
+     */
+    void assign(const T *values, std::size_t count) {
+        variables.clear();
+        ids.clear();
+        variables.reserve(count);
+        ids.reserve(count);
+        for (std::size_t i = 0; i < count; i++) {
+            add(values[i]);
+        }
+    }
+
+    std::size_t size() const { return variables.size(); }
+
+    const DiffValue<T> &operator[](std::size_t id) const {
+        return variables[id];
+    }
+
+    auto begin() const { return variables.begin(); }
+
+    auto end() const { return variables.end(); }
+
+    /**
+     * The id of a variable in this registry, or size() if it isn't one.
+     */
+    std::size_t idOf(const DiffValue<T> &value) const {
+        auto itr = ids.find(impl::getDiffValueNode(value).get());
+        return itr != ids.end() ? itr->second : size();
+    }
+
+    /**
+     * Writes the numeric derivatives of value wrt every variable to out,
+     * which must have room for size() elements, in one sweep.
+     */
+    template <typename Acc = AccumulatorTypeT<T>>
+    void gradient(const DiffValue<T> &value, T *out,
+                  Summation summation = Summation::Naive,
+                  GraphRetention retention = GraphRetention::Retain) const {
+        std::unordered_map<const impl::Node<T> *, std::size_t> positions;
+        auto order = impl::topologicalOrder(impl::getDiffValueNode(value),
+                                            &positions);
+        std::vector<Acc> tagged(order.size(), Acc(0));
+        tagged[0] = Acc(1);
+        // remember which positions hold our variables before the sweep, in
+        // case it releases them
+        std::vector<std::pair<std::size_t, std::size_t>> slots;
+        for (std::size_t id = 0; id < size(); id++) {
+            auto itr =
+                positions.find(impl::getDiffValueNode(variables[id]).get());
+            if (itr != positions.end()) {
+                slots.emplace_back(itr->second, id);
+            }
+        }
+        auto adjoints = impl::accumulateAdjoints<Acc>(
+            order, positions, std::move(tagged), summation, retention);
+        std::fill(out, out + size(), T(0));
+        for (const auto &[position, id] : slots) {
+            out[id] = static_cast<T>(adjoints[position]);
+        }
+    }
+
+    /**
+     * Returns the numeric derivatives of value wrt every variable, by id.
+     */
+    std::vector<T> gradient(const DiffValue<T> &value) const {
+        std::vector<T> out(size());
+        gradient(value, out.data());
+        return out;
+    }
+
+private:
+    std::vector<DiffValue<T>> variables;
+    // the id of each variable's node. The variables keep the nodes alive,
+    // so their addresses aren't reused while they are keys.
+    std::unordered_map<const impl::Node<T> *, std::size_t> ids;
+};
+
+} // namespace leningrad
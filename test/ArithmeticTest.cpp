@@ -2,6 +2,10 @@
 #define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include <catch2/catch.hpp>
 
+#include <cmath>
+#include <limits>
+#include <vector>
+
 #include "../src/Core.h"
 
 using namespace leningrad;
@@ -33,6 +37,151 @@ TEST_CASE("Test DiffValue Multiplication", "[DiffValue][DiffOp]") {
     REQUIRE((3. * a).value() == 12_a);
 }
 
+TEST_CASE("Test DiffValue Temporaries", "[DiffValue][DiffOp]") {
+    ddouble a = 4;
+    ddouble b = 3;
+    ddouble c = (a * b) * (a - b) / (a + b);
+    REQUIRE(c.value() == Approx(12. / 7));
+    auto dc = differentiate(c);
+    REQUIRE(dc.wrt(a).value() == Approx((2 * 4 * 3 - 9) / 7. - 12. / 49));
+    REQUIRE(dc.wrt(b).value() == Approx((16 - 2 * 4 * 3) / 7. - 12. / 49));
+    REQUIRE(a.value() == 4);
+    REQUIRE(b.value() == 3);
+
+    ddouble d = a;
+    d += d;
+    d *= std::move(b);
+    d -= 1.;
+    d /= a * 2.;
+    REQUIRE(d.value() == Approx(23. / 8));
+    REQUIRE(differentiate(d).wrt(a).value() == Approx(1. / 32));
+}
+
+TEST_CASE("Test Sum And Product", "[DiffValue][DiffOp]") {
+    std::vector<ddouble> xs{1.5, -2, 3, 0.5};
+    ddouble s = sum(xs.begin(), xs.end());
+    ddouble p = product(xs.begin(), xs.end());
+    REQUIRE(s.value() == Approx(3));
+    REQUIRE(p.value() == Approx(-4.5));
+
+    auto ds = differentiate(s);
+    auto dp = differentiate(p);
+    for (const ddouble &x : xs) {
+        REQUIRE(ds.wrt(x).value() == 1);
+        REQUIRE(dp.wrt(x).value() == Approx(p.value() / x.value()));
+    }
+    REQUIRE(differentiate(p, {xs[0], xs[1]}).value() == Approx(1.5));
+    REQUIRE(differentiate(p, xs[0], 2).value() == 0);
+
+    std::vector<ddouble> withZero{2, 0, 5};
+    ddouble q = product(withZero.begin(), withZero.end());
+    REQUIRE(q.value() == 0);
+    REQUIRE(differentiate(q).wrt(withZero[1]).value() == Approx(10));
+
+    std::vector<ddouble> none;
+    REQUIRE(sum(none.begin(), none.end()).value() == 0);
+    REQUIRE(product(none.begin(), none.end()).value() == 1);
+}
+
+TEST_CASE("Test Accumulator", "[DiffValue][DiffOp]") {
+    ddouble x = 2;
+    Accumulator<double> acc;
+    REQUIRE(acc.sum().value() == 0);
+    for (int i = 1; i <= 100; i++) {
+        acc += x * static_cast<double>(i);
+    }
+    acc -= x;
+    acc += 1.;
+    REQUIRE(acc.size() == 101);
+    ddouble total = acc.sum();
+    REQUIRE(total.value() == Approx(2 * 5050 - 2 + 1));
+    REQUIRE(differentiate(total).wrt(x).value() == Approx(5049));
+}
+
+TEST_CASE("Test Construction-Time Simplification", "[DiffValue][DiffOp]") {
+    ddouble x = 2.5;
+    const auto &node = impl::getDiffValueNode(x);
+    auto same = [&](const ddouble &y) {
+        return impl::getDiffValueNode(y) == node;
+    };
+
+    SECTION("Identities With Numbers") {
+        REQUIRE(same(x * 1));
+        REQUIRE(same(1. * x));
+        REQUIRE(same(x + 0));
+        REQUIRE(same(0 + x));
+        REQUIRE(same(x - 0.));
+        REQUIRE(same(x / 1));
+        REQUIRE(same(pow(x, 1)));
+        REQUIRE(same(-(-x)));
+        REQUIRE(same(-(x * -1)));
+    }
+
+    SECTION("Identities With Constants") {
+        ddouble one = impl::constant(1.0);
+        ddouble zero = impl::constant(0.0);
+        REQUIRE(same(x * one));
+        REQUIRE(same(one * x));
+        REQUIRE(same(x + zero));
+        REQUIRE(same(zero + x));
+        REQUIRE(same(x - zero));
+        REQUIRE(same(x / one));
+        REQUIRE(same(pow(x, one)));
+        REQUIRE(impl::isConstant(one + zero * 3 - one / 2, 0.5));
+    }
+
+    SECTION("Zeros") {
+        for (const ddouble &y :
+             {x * 0, 0 * x, x - x, x * impl::constant(0.0), pow(x, 0)}) {
+            REQUIRE(impl::isConstant(y));
+            REQUIRE(differentiate(y).wrt(x).value() == 0);
+        }
+        REQUIRE((x - x).value() == 0);
+        REQUIRE(pow(x, 0).value() == 1);
+    }
+
+    SECTION("Variables Stay Variables") {
+        // plain leaves are variables even when they hold 0 or 1
+        ddouble one = 1;
+        ddouble y = x * one;
+        REQUIRE_FALSE(same(y));
+        REQUIRE(differentiate(y).wrt(one).value() == Approx(2.5));
+    }
+
+    SECTION("Non-Finite Values") {
+        ddouble inf = std::numeric_limits<double>::infinity();
+        REQUIRE(std::isnan((inf * 0).value()));
+        REQUIRE(std::isnan((inf - inf).value()));
+    }
+
+    SECTION("Unsigned Scalars") {
+        // -1 converted to unsigned is UINT_MAX, which is not an identity
+        unsigned int big = 4294967295u;
+        ddouble y = x * big;
+        REQUIRE(y.value() > 0);
+        REQUIRE(y.value() == Approx(2.5 * 4294967295.0));
+        REQUIRE(differentiate(y).wrt(x).value() == Approx(4294967295.0));
+        REQUIRE((big * x).value() == Approx(2.5 * 4294967295.0));
+        REQUIRE((3u / x).value() == Approx(1.2));
+        REQUIRE(differentiate(3u / x).wrt(x).value() == Approx(-0.48));
+        REQUIRE(same(x * 1u));
+        REQUIRE(impl::isConstant(x * 0u));
+    }
+
+    SECTION("Higher Order Derivatives") {
+        ddouble y = 1.3;
+        ddouble z = sin(x * y) * exp(x) / (1 + x * x) + pow(x, 3) * y;
+        ddouble d4 = differentiate(z, x, 4);
+        // 609 nodes without simplification
+        REQUIRE(impl::topologicalOrder(impl::getDiffValueNode(d4)).size() <
+                400);
+        // constant derivatives can still be used as variables
+        ddouble dy = differentiate(2 * y).wrt(y);
+        REQUIRE_FALSE(impl::isConstant(dy));
+        REQUIRE(differentiate(dy * 3).wrt(dy).value() == 3);
+    }
+}
+
 TEST_CASE("DiffValue Arithmetic Benchmark", "[DiffValue][Benchmark]") {
     ddouble a = 10;
     ddouble b = 2;
@@ -50,3 +199,22 @@ TEST_CASE("DiffValue Arithmetic Benchmark", "[DiffValue][Benchmark]") {
         return Z;
     };
 }
+
+TEST_CASE("Accumulation Benchmark", "[DiffValue][Benchmark]") {
+    std::vector<ddouble> xs(1000, 0.5);
+    BENCHMARK("Chained +=") {
+        ddouble loss = 0;
+        for (const ddouble &x : xs) {
+            loss += x * x;
+        }
+        return differentiate(loss).wrt(xs[0]);
+    };
+
+    BENCHMARK("Accumulator") {
+        Accumulator<double> loss;
+        for (const ddouble &x : xs) {
+            loss += x * x;
+        }
+        return differentiate(loss.sum()).wrt(xs[0]);
+    };
+}
@@ -0,0 +1,112 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <functional>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "../src/Core.h"
+#include "../src/AsyncDerivative.h"
+
+using namespace leningrad;
+
+#ifndef LENINGRAD_SINGLE_THREADED
+
+namespace {
+ddouble sampleLoss(const std::vector<ddouble> &weights, double sample) {
+    Accumulator<double> loss;
+    for (std::size_t i = 0; i < weights.size(); i++) {
+        loss += square(tanh(weights[i] * sample) - 0.5);
+    }
+    return loss.sum();
+}
+} // namespace
+
+TEST_CASE("Test async differentiation", "[Async]") {
+    ddouble x = 1.5;
+    ddouble y = 0.5;
+    auto future = differentiateAsync(sin(x) * y + x);
+    auto result = future.get();
+    REQUIRE(result.wrt(x).value() == Approx(std::cos(1.5) * 0.5 + 1));
+    REQUIRE(result.wrt(y).value() == Approx(std::sin(1.5)));
+
+    auto grad = gradientAsync(x * x * y).get();
+    REQUIRE(grad.wrt(x) == Approx(1.5));
+    REQUIRE(grad.wrt(y) == Approx(2.25));
+}
+
+TEST_CASE("Test async pipeline with shared leaves", "[Async]") {
+    std::vector<ddouble> weights;
+    for (int i = 0; i < 20; i++) {
+        weights.emplace_back(0.05 * i);
+    }
+
+    std::vector<std::vector<double>> expected;
+    for (int k = 0; k < 10; k++) {
+        auto grad = gradient(sampleLoss(weights, k * 0.1));
+        expected.emplace_back();
+        for (const ddouble &w : weights) {
+            expected.back().push_back(grad.wrt(w));
+        }
+    }
+
+    // build sample k + 1 while sample k is swept
+    std::vector<std::future<GradientResult<double, double>>> pending;
+    for (int k = 0; k < 10; k++) {
+        pending.push_back(gradientAsync(sampleLoss(weights, k * 0.1)));
+    }
+    for (int k = 0; k < 10; k++) {
+        auto grad = pending[k].get();
+        for (std::size_t i = 0; i < weights.size(); i++) {
+            REQUIRE(grad.wrt(weights[i]) == Approx(expected[k][i]));
+        }
+    }
+}
+
+TEST_CASE("Test async differentiation on an executor", "[Async]") {
+    std::vector<std::thread> threads;
+    Executor executor = [&threads](std::function<void()> task) {
+        threads.emplace_back(std::move(task));
+    };
+    ddouble x = 2;
+    auto first = differentiateAsync(x * x, GraphRetention::Release, executor);
+    auto second = gradientAsync(exp(x), Summation::Compensated,
+                                GraphRetention::Retain, executor);
+    REQUIRE(first.get().wrt(x).value() == Approx(4));
+    REQUIRE(second.get().wrt(x) == Approx(std::exp(2)));
+    REQUIRE(threads.size() == 2);
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+TEST_CASE("Async pipeline Benchmark", "[Async][Benchmark]") {
+    std::vector<ddouble> weights;
+    for (int i = 0; i < 200; i++) {
+        weights.emplace_back(0.005 * i);
+    }
+
+    BENCHMARK("Synchronous") {
+        double total = 0;
+        for (int k = 0; k < 20; k++) {
+            total += gradient(sampleLoss(weights, k * 0.05)).wrt(weights[0]);
+        }
+        return total;
+    };
+
+    BENCHMARK("Overlapped") {
+        double total = 0;
+        std::future<GradientResult<double, double>> previous;
+        for (int k = 0; k < 20; k++) {
+            ddouble loss = sampleLoss(weights, k * 0.05);
+            if (previous.valid()) {
+                total += previous.get().wrt(weights[0]);
+            }
+            previous = gradientAsync(std::move(loss));
+        }
+        return total + previous.get().wrt(weights[0]);
+    };
+}
+
+#endif
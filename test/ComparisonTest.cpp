@@ -1,5 +1,7 @@
 #include <catch2/catch.hpp>
 
+#include <algorithm>
+
 #include "../src/Core.h"
 
 using namespace leningrad;
@@ -69,3 +71,56 @@ TEST_CASE("Test max", "[Comparison]") {
     }
 }
 
+
+TEST_CASE("Test where", "[Comparison]") {
+    ddouble a = 2;
+    ddouble b = 5;
+    for (bool cond : {true, false}) {
+        ddouble z = where(cond, a * a, b * b);
+        REQUIRE(z.value() == (cond ? 4 : 25));
+        auto dz = differentiate(z);
+        REQUIRE(dz.wrt(a).value() == (cond ? 4 : 0));
+        REQUIRE(dz.wrt(b).value() == (cond ? 0 : 10));
+        // the same graph, whichever branch is taken
+        REQUIRE(impl::getDiffValueNode(z)->edges.size() == 2);
+
+        ddouble w = where(cond, a, 7.0);
+        REQUIRE(w.value() == (cond ? 2 : 7));
+        REQUIRE(gradient(w).wrt(a) == (cond ? 1 : 0));
+        w = where(cond, 7.0, b);
+        REQUIRE(w.value() == (cond ? 7 : 5));
+        REQUIRE(gradient(w).wrt(b) == (cond ? 0 : 1));
+    }
+}
+
+TEST_CASE("Test clamp", "[Comparison]") {
+    ddouble lo = -1;
+    ddouble hi = 1;
+    for (double p : {-2.0, 0.5, 3.0}) {
+        ddouble x = p;
+        ddouble z = clamp(x, lo, hi);
+        REQUIRE(z.value() == std::clamp(p, -1.0, 1.0));
+        auto grad = gradient(z);
+        REQUIRE(grad.wrt(x) == (p == 0.5 ? 1 : 0));
+        REQUIRE(grad.wrt(lo) == (p < -1 ? 1 : 0));
+        REQUIRE(grad.wrt(hi) == (p > 1 ? 1 : 0));
+        REQUIRE(impl::getDiffValueNode(z)->edges.size() == 3);
+
+        ddouble y = clamp(x, -1.0, 1.0);
+        REQUIRE(y.value() == z.value());
+        REQUIRE(differentiate(y).wrt(x).value() == grad.wrt(x));
+    }
+}
+
+TEST_CASE("Test piecewise graph shape", "[Comparison]") {
+    ddouble x = 3;
+    ddouble y = 4;
+    // min and max make a node even when they pick one operand, so the graph
+    // doesn't depend on the values
+    REQUIRE(impl::getDiffValueNode(min(x, y)) != impl::getDiffValueNode(x));
+    REQUIRE(impl::getDiffValueNode(max(x, y))->edges.size() ==
+            impl::getDiffValueNode(max(y, x))->edges.size());
+    // second derivatives through the selected branch survive
+    ddouble z = max(x * x * x, y);
+    REQUIRE(differentiate(z, x, 2).value() == 18);
+}
@@ -0,0 +1,165 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/Core.h"
+#include "LiveCountingResource.h"
+
+using namespace leningrad;
+
+namespace {
+// one shared graph with several outputs, all depending on all the weights
+struct Model {
+    std::vector<ddouble> weights;
+    std::vector<ddouble> outputs;
+
+    Model(std::size_t size, std::size_t outputCount) {
+        for (std::size_t i = 0; i < size; i++) {
+            weights.emplace_back(std::sin(1.0 + i));
+        }
+        for (std::size_t k = 0; k < outputCount; k++) {
+            Accumulator<double> output;
+            for (std::size_t i = 0; i < size; i++) {
+                ddouble hidden = tanh(weights[i] * (0.1 * k + 0.5));
+                output += square(hidden - weights[(i + k) % size]);
+            }
+            outputs.push_back(output.sum());
+        }
+    }
+};
+
+std::vector<double> gradientOf(const Model &model, std::size_t output) {
+    auto grad = gradient(model.outputs[output]);
+    std::vector<double> result;
+    for (const ddouble &w : model.weights) {
+        result.push_back(grad.wrt(w));
+    }
+    return result;
+}
+} // namespace
+
+TEST_CASE("Test numeric sweeps only read the graph", "[Concurrent]") {
+    LiveCountingResource resource;
+    NodeResourceScope scope(&resource);
+    Model model(50, 2);
+    long allocated = resource.allocated;
+    auto expected = gradientOf(model, 0);
+    REQUIRE(gradientOf(model, 1).size() == 50);
+    REQUIRE(gradientOf(model, 0) == expected);
+    // the partials were computed as plain numbers, without creating nodes
+    REQUIRE(resource.allocated == allocated);
+}
+
+#ifndef LENINGRAD_SINGLE_THREADED
+
+TEST_CASE("Test concurrent gradients", "[Concurrent]") {
+    std::size_t threadCount = 4;
+    Model model(100, 8);
+    std::vector<std::vector<double>> expected;
+    {
+        // reference results from a separate copy of the graph, so the
+        // threads below start from a graph with nothing cached
+        Model reference(100, 8);
+        for (std::size_t k = 0; k < reference.outputs.size(); k++) {
+            expected.push_back(gradientOf(reference, k));
+        }
+    }
+
+    std::vector<std::vector<std::vector<double>>> results(threadCount);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < threadCount; t++) {
+        threads.emplace_back([&, t]() {
+            for (int repeat = 0; repeat < 3; repeat++) {
+                for (std::size_t k = 0; k < model.outputs.size(); k++) {
+                    results[t].push_back(gradientOf(model, (k + t) % 8));
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (std::size_t t = 0; t < threadCount; t++) {
+        for (std::size_t r = 0; r < results[t].size(); r++) {
+            REQUIRE(results[t][r] == expected[(r % 8 + t) % 8]);
+        }
+    }
+}
+
+TEST_CASE("Test concurrent symbolic derivatives", "[Concurrent]") {
+    std::size_t threadCount = 4;
+    Model model(30, 4);
+    std::vector<double> expected;
+    {
+        Model reference(30, 4);
+        for (const ddouble &output : reference.outputs) {
+            expected.push_back(
+                differentiate(output, reference.weights[3], 2).value());
+        }
+    }
+
+    std::vector<std::vector<double>> results(threadCount);
+    std::vector<std::vector<double>> cachedResults(threadCount);
+    std::vector<std::vector<const impl::Node<double> *>> derivativeNodes(
+        threadCount);
+    DerivativeCache<double> cache;
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < threadCount; t++) {
+        threads.emplace_back([&, t]() {
+            const ddouble &w = model.weights[3];
+            for (std::size_t k = 0; k < model.outputs.size(); k++) {
+                const ddouble &output = model.outputs[(k + t) % 4];
+                results[t].push_back(differentiate(output, w, 2).value());
+                // with a shared cache, each derivative graph is built once,
+                // by whichever thread gets there first
+                ddouble first = differentiate(output, cache).wrt(w);
+                cachedResults[t].push_back(
+                    differentiate(first, cache).wrt(w).value());
+                derivativeNodes[t].push_back(
+                    impl::getDiffValueNode(first).get());
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (std::size_t t = 0; t < threadCount; t++) {
+        for (std::size_t k = 0; k < model.outputs.size(); k++) {
+            REQUIRE(results[t][k] == Approx(expected[(k + t) % 4]));
+            REQUIRE(cachedResults[t][k] == Approx(expected[(k + t) % 4]));
+            REQUIRE(derivativeNodes[t][k] ==
+                    derivativeNodes[0][(k + t) % 4]);
+        }
+    }
+}
+
+TEST_CASE("Concurrent Sweep Benchmark", "[Concurrent][Benchmark]") {
+    Model model(2000, 8);
+
+    // the same 16 gradients, split between the threads
+    for (std::size_t threadCount : {1, 2, 4}) {
+        BENCHMARK("16 Gradients On " + std::to_string(threadCount) +
+                  " Threads") {
+            std::vector<double> totals(threadCount);
+            std::vector<std::thread> threads;
+            for (std::size_t t = 0; t < threadCount; t++) {
+                threads.emplace_back([&, t]() {
+                    for (std::size_t k = t; k < 16; k += threadCount) {
+                        totals[t] += gradientOf(model, k % 8)[0];
+                    }
+                });
+            }
+            for (auto &thread : threads) {
+                thread.join();
+            }
+            return totals;
+        };
+    }
+}
+
+#endif
@@ -1,6 +1,10 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include <catch2/catch.hpp>
 
+#include <vector>
+
 #include "../src/Core.h"
+#include "LiveCountingResource.h"
 
 using namespace leningrad;
 
@@ -19,6 +23,31 @@ TEST_CASE("Test Derivative", "[Derivative]") {
     REQUIRE(differentiate(y).wrt(x).value() == 0);
 }
 
+TEST_CASE("Test Derivative Through Paths Of Different Lengths",
+          "[Derivative]") {
+    ddouble x = 0.7;
+    ddouble u = 2 * x;
+    ddouble z = sin(sin(u)) + u;
+    double uv = u.value();
+    REQUIRE(differentiate(z).wrt(x).value() ==
+            Approx(2 * (std::cos(std::sin(uv)) * std::cos(uv) + 1)));
+    REQUIRE(differentiate(z).wrt(u).value() ==
+            Approx(std::cos(std::sin(uv)) * std::cos(uv) + 1));
+}
+
+TEST_CASE("Test Derivative Of Long Chains", "[Derivative]") {
+    ddouble x = 0.5;
+    ddouble y = x;
+    for (int i = 0; i < 10000; i++) {
+        y = y * 1.0001 + x;
+    }
+    double expected = 0;
+    for (int i = 0; i < 10001; i++) {
+        expected = expected * 1.0001 + 1;
+    }
+    REQUIRE(differentiate(y).wrt(x).value() == Approx(expected));
+}
+
 TEST_CASE("Test Higher Order Derivative", "[Derivative]") {
     SECTION("Exp") {
         ddouble x = 3.5;
@@ -88,3 +117,236 @@ TEST_CASE("Test Cross Derivative", "[Derivative]") {
         REQUIRE(dbdxyzCalc == Approx(dadxyz));
     }
 }
+
+TEST_CASE("Test Numeric Gradient", "[Derivative]") {
+    ddouble x = 3;
+    ddouble y = 10;
+    ddouble z = x * y - x / y + sin(x * x);
+    auto grad = gradient(z);
+    auto diff = differentiate(z);
+    REQUIRE(grad.wrt(x) == Approx(diff.wrt(x).value()));
+    REQUIRE(grad.wrt(y) == Approx(diff.wrt(y).value()));
+    REQUIRE(grad.wrt(z) == 1);
+    REQUIRE(grad.hasDerivative(x));
+
+    ddouble unrelated = 1;
+    REQUIRE_FALSE(grad.hasDerivative(unrelated));
+    REQUIRE(grad.wrt(unrelated) == 0);
+}
+
+TEST_CASE("Test Mixed Precision Gradient", "[Derivative]") {
+    dfloat x = 1;
+    Accumulator<float> acc;
+    for (int i = 0; i < 100000; i++) {
+        acc += x * 0.1f;
+    }
+    dfloat y = acc.sum();
+    double exact = 100000 * static_cast<double>(0.1f);
+
+    auto wide = gradient(y);
+    static_assert(std::is_same_v<decltype(wide.wrt(x)), double>);
+    REQUIRE(wide.wrt(x) == Approx(exact).epsilon(1e-12));
+
+    auto compensated = gradient<float>(y, Summation::Compensated);
+    REQUIRE(compensated.wrt(x) == Approx(exact).epsilon(1e-6));
+
+    auto narrow = gradient<float>(y);
+    REQUIRE(std::abs(narrow.wrt(x) - exact) >
+            std::abs(compensated.wrt(x) - exact));
+}
+
+namespace {
+// The bytes held by the nodes of value's graph and their edge arrays, not
+// counting closures too large for std::function to store inline.
+template <typename T> std::size_t tapeBytes(T start, int steps) {
+    LiveCountingResource resource;
+    NodeResourceScope scope(&resource);
+    DiffValue<T> x = start;
+    DiffValue<T> y = x;
+    for (int i = 0; i < steps; i++) {
+        y = sin(y) * x + y;
+    }
+    std::size_t bytes = resource.liveBytes;
+    for (const auto &node : impl::topologicalOrder(impl::getDiffValueNode(y))) {
+        bytes += node->edges.capacity() * sizeof(impl::Edge<T>);
+    }
+    return bytes;
+}
+} // namespace
+
+TEST_CASE("Test Mixed Precision Tape Size", "[Derivative]") {
+    // Narrow values shrink the nodes, but not the edges, which hold the
+    // partial rules rather than values. Those dominate the tape, so a dfloat
+    // tape is smaller than a ddouble one, but by much less than half.
+    static_assert(sizeof(impl::Node<float>) < sizeof(impl::Node<double>));
+    static_assert(sizeof(impl::Edge<float>) == sizeof(impl::Edge<double>));
+    std::size_t narrow = tapeBytes(0.5f, 100);
+    std::size_t wide = tapeBytes(0.5, 100);
+    REQUIRE(narrow < wide);
+    REQUIRE(2 * narrow > wide);
+}
+
+#if defined(__STDCPP_FLOAT16_T__) || defined(__STDCPP_BFLOAT16_T__)
+namespace {
+// Past 1024 (128 for bfloat16), adding 0.5 to a 16-bit float no longer
+// changes it, so the adjoint of x only comes out right if it is accumulated
+// wider.
+template <typename T> void checkHalfPrecisionGradient() {
+    DiffValue<T> x = T(1);
+    Accumulator<T> acc;
+    for (int i = 0; i < 4096; i++) {
+        acc += x * T(0.5);
+    }
+    DiffValue<T> y = acc.sum();
+
+    auto wide = gradient(y);
+    static_assert(std::is_same_v<decltype(wide.wrt(x)), float>);
+    REQUIRE(wide.wrt(x) == 2048);
+
+    auto narrow = gradient<T>(y);
+    REQUIRE(narrow.wrt(x) < T(2048));
+}
+} // namespace
+#endif
+
+#ifdef __STDCPP_FLOAT16_T__
+TEST_CASE("Test Half Precision Gradient", "[Derivative]") {
+    checkHalfPrecisionGradient<std::float16_t>();
+}
+#endif
+
+#ifdef __STDCPP_BFLOAT16_T__
+TEST_CASE("Test Bfloat16 Gradient", "[Derivative]") {
+    checkHalfPrecisionGradient<std::bfloat16_t>();
+}
+#endif
+
+TEST_CASE("Test Releasing The Graph", "[Derivative]") {
+    LiveCountingResource resource;
+    NodeResourceScope scope(&resource);
+    ddouble x = 0.5;
+    ddouble y = 2;
+    ddouble z = sin(x * y) * exp(y) + x / y;
+    REQUIRE(resource.live == 8);
+
+    double dzdx = differentiate(z).wrt(x).value();
+    double dzdy = differentiate(z).wrt(y).value();
+    // the derivative graphs went with the results
+    REQUIRE(resource.live == 8);
+
+    SECTION("Symbolic") {
+        {
+            auto dz = differentiate(z, GraphRetention::Release);
+            REQUIRE(dz.wrt(x).value() == Approx(dzdx));
+            REQUIRE(dz.wrt(y).value() == Approx(dzdy));
+            REQUIRE(dz.wrt(z).value() == 1);
+        }
+        REQUIRE(resource.live == 3);
+    }
+
+    SECTION("Numeric") {
+        auto grad = gradient(z, Summation::Naive, GraphRetention::Release);
+        REQUIRE(resource.live == 3);
+        REQUIRE(grad.wrt(x) == Approx(dzdx));
+        REQUIRE(grad.wrt(y) == Approx(dzdy));
+    }
+
+    // the graph has been consumed
+    REQUIRE(differentiate(z).wrt(x).value() == 0);
+}
+
+TEST_CASE("Test Memoized Derivatives", "[Derivative]") {
+    LiveCountingResource resource;
+    NodeResourceScope scope(&resource);
+    ddouble x = 0.3;
+    ddouble y = 1.7;
+    ddouble z = tan(x * y) / (x + y) + sin(x) * cos(y);
+    long graph = resource.live;
+
+    SECTION("Uncached") {
+        auto first = differentiate(z);
+        auto second = differentiate(z);
+        REQUIRE(impl::getDiffValueNode(first.wrt(x)) !=
+                impl::getDiffValueNode(second.wrt(x)));
+        REQUIRE(first.wrt(x).value() == second.wrt(x).value());
+    }
+
+    SECTION("Repeated") {
+        DerivativeCache<double> cache;
+        auto first = differentiate(z, cache);
+        long live = resource.live;
+        auto second = differentiate(z, cache);
+        REQUIRE(resource.live == live);
+        REQUIRE(impl::getDiffValueNode(first.wrt(x)) ==
+                impl::getDiffValueNode(second.wrt(x)));
+        REQUIRE(second.hasDerivative(y));
+        REQUIRE_FALSE(second.hasDerivative(ddouble(1)));
+    }
+
+    SECTION("Cross") {
+        DerivativeCache<double> cache;
+        auto cross = [&](const ddouble &a, const ddouble &b) {
+            return differentiate(differentiate(z, cache).wrt(a), cache)
+                .wrt(b)
+                .value();
+        };
+        double dxy = cross(x, y);
+        long live = resource.live;
+        REQUIRE(cross(x, y) == dxy);
+        REQUIRE(resource.live == live);
+        // only the second differentiation is new
+        REQUIRE(cross(y, x) == Approx(dxy));
+        REQUIRE(resource.live > live);
+        REQUIRE(differentiate(z, {x, y}).value() == Approx(dxy));
+    }
+
+    SECTION("Higher Order") {
+        double d4 = differentiate(z, x, 4).value();
+        REQUIRE(differentiate(z, x, 3).value() ==
+                Approx(differentiate(differentiate(z, x, 2), x, 1).value()));
+        REQUIRE(differentiate(z, x, 4).value() == d4);
+    }
+
+    SECTION("Numeric Sweeps Agree") {
+        DerivativeCache<double> cache;
+        auto grad = gradient(z);
+        REQUIRE(grad.wrt(x) == Approx(differentiate(z, cache).wrt(x).value()));
+        REQUIRE(grad.wrt(y) == Approx(differentiate(z, cache).wrt(y).value()));
+    }
+
+    // nothing outlives the results and caches
+    REQUIRE(resource.live == graph);
+}
+
+TEST_CASE("Memoized Derivatives Benchmark", "[Derivative][Benchmark]") {
+    std::vector<ddouble> xs;
+    for (int i = 0; i < 6; i++) {
+        xs.emplace_back(0.1 * (i + 1));
+    }
+    auto denseHessian = [&](DerivativeCache<double> *cache) {
+        ddouble f = 0;
+        for (std::size_t i = 0; i < xs.size(); i++) {
+            f = f + sin(xs[i] * xs[(i + 1) % xs.size()]) / (1 + xs[i]);
+        }
+        auto derivatives = [&](const ddouble &value) {
+            return cache ? differentiate(value, *cache) : differentiate(value);
+        };
+        double total = 0;
+        for (const ddouble &a : xs) {
+            ddouble da = derivatives(f).wrt(a);
+            for (const ddouble &b : xs) {
+                total += derivatives(da).wrt(b).value();
+            }
+        }
+        return total;
+    };
+
+    BENCHMARK("Dense Hessian By Repeated differentiate()") {
+        return denseHessian(nullptr);
+    };
+
+    BENCHMARK("Dense Hessian By Repeated differentiate() With A Cache") {
+        DerivativeCache<double> cache;
+        return denseHessian(&cache);
+    };
+}
@@ -1,9 +1,12 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include <catch2/catch.hpp>
 
+#include <algorithm>
 #include <cmath>
 #include <functional>
 #include <string>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 #include "../src/Core.h"
@@ -56,6 +59,12 @@ TEST_CASE("Test univariate funcs over R", "[DiffOp]") {
                        [](double x) { return std::erf(x); });
     funcs.emplace_back("erfc", leningrad::erfc<double>,
                        [](double x) { return std::erfc(x); });
+    funcs.emplace_back("expm1", leningrad::expm1<double>,
+                       [](double x) { return std::expm1(x); });
+    funcs.emplace_back("sigmoid", leningrad::sigmoid<double>,
+                       [](double x) { return 1 / (1 + std::exp(-x)); });
+    funcs.emplace_back("softplus", leningrad::softplus<double>,
+                       [](double x) { return std::log(1 + std::exp(x)); });
 
     std::vector<double> points{0.1, 1, -1, 3.5, -3.5};
 
@@ -90,6 +99,8 @@ TEST_CASE("Test univariate funcs over R+", "[DiffOp]") {
                        [](double x) { return std::log2(x); });
     funcs.emplace_back("acosh", leningrad::acosh<double>,
                        [](double x) { return std::acosh(x); });
+    funcs.emplace_back("log1p", leningrad::log1p<double>,
+                       [](double x) { return std::log1p(x); });
 
     std::vector<double> points{1.1, 2, 3.5};
 
@@ -182,6 +193,87 @@ TEST_CASE("Test bivariate functions over R2", "[DiffOp]") {
     }
 }
 
+TEST_CASE("Test atan2 on the axes", "[DiffOp]") {
+    std::vector<std::pair<double, double>> points{
+        {0, 2}, {0, -2}, {2, 0}, {-2, 0}, {-1e-3, -2}};
+    for (const auto &p : points) {
+        ddouble y(p.first);
+        ddouble x(p.second);
+        ddouble z = atan2(y, x);
+        INFO("Testing atan2 at (y,x)=(" << p.first << ", " << p.second << ")");
+        REQUIRE(z.value() == Approx(std::atan2(p.first, p.second)));
+        auto dz = differentiate(z);
+        double r2 = p.first * p.first + p.second * p.second;
+        REQUIRE(dz.wrt(y).value() == Approx(p.second / r2));
+        REQUIRE(dz.wrt(x).value() == Approx(-p.first / r2));
+        // a single node, whatever the quadrant
+        REQUIRE(impl::getDiffValueNode(z)->edges.size() == 2);
+
+        REQUIRE(differentiate(atan2(y, p.second)).wrt(y).value() ==
+                Approx(p.second / r2));
+        REQUIRE(differentiate(atan2(p.first, x)).wrt(x).value() ==
+                Approx(-p.first / r2));
+    }
+
+    // second derivatives: d2/dy2 atan2(y, x) = -2xy / (x^2 + y^2)^2
+    ddouble y = 1;
+    ddouble x = 2;
+    REQUIRE(differentiate(atan2(y, x), y, 2).value() == Approx(-4.0 / 25));
+}
+
+TEST_CASE("Test atan2 with integer scalars", "[DiffOp]") {
+    ddouble x = 2;
+    ddouble y = 1;
+
+    // -y on an unsigned scalar would wrap around
+    ddouble z = atan2(3u, x);
+    REQUIRE(z.value() == Approx(std::atan2(3.0, 2.0)));
+    REQUIRE(differentiate(z).wrt(x).value() == Approx(-3.0 / 13));
+    REQUIRE(gradient(z).wrt(x) == Approx(-3.0 / 13));
+    REQUIRE(differentiate(z, x, 2).value() == Approx(12.0 / 169));
+
+    // x * x on an int scalar this large would overflow
+    int big = 100000;
+    double r2 = 1e10 + 1;
+    ddouble w = atan2(y, big);
+    REQUIRE(differentiate(w).wrt(y).value() == Approx(big / r2));
+    REQUIRE(gradient(w).wrt(y) == Approx(big / r2));
+    ddouble v = atan2(big, x);
+    double s2 = 1e10 + 4;
+    REQUIRE(differentiate(v).wrt(x).value() == Approx(-big / s2));
+    REQUIRE(gradient(v).wrt(x) == Approx(-big / s2));
+}
+
+TEST_CASE("Test relu", "[DiffOp]") {
+    for (double p : {-1.5, 0.0, 2.5}) {
+        ddouble x = p;
+        ddouble y = relu(x);
+        REQUIRE(y.value() == std::max(p, 0.0));
+        REQUIRE(gradient(y).wrt(x) == (p > 0 ? 1 : 0));
+        REQUIRE(impl::getDiffValueNode(y)->edges.size() == 1);
+    }
+}
+
+TEST_CASE("Test fmod", "[DiffOp]") {
+    std::vector<std::pair<double, double>> points{
+        {5.5, 2}, {-5.5, 2}, {5.5, -2}, {1, 3}};
+    for (const auto &p : points) {
+        ddouble x(p.first);
+        ddouble y(p.second);
+        ddouble z = fmod(x, y);
+        INFO("Testing fmod at (x,y)=(" << p.first << ", " << p.second << ")");
+        REQUIRE(z.value() == std::fmod(p.first, p.second));
+        auto dz = differentiate(z);
+        REQUIRE(dz.wrt(x).value() == 1);
+        REQUIRE(dz.wrt(y).value() ==
+                Approx(numericalDifferentiate(
+                    [&](double y) { return std::fmod(p.first, y); },
+                    p.second)));
+        REQUIRE(gradient(fmod(x, p.second)).wrt(x) == 1);
+        REQUIRE(gradient(fmod(p.first, y)).wrt(y) == dz.wrt(y).value());
+    }
+}
+
 TEST_CASE("Test pow", "[DiffOp]") {
     std::vector<double> xs{1, 2.5, 3};
     std::vector<double> ys{-1.5, -1, 0, 1, 1.5};
@@ -257,3 +349,150 @@ TEST_CASE("Test log") {
         }
     }
 }
+
+TEST_CASE("Test second derivatives of fused functions", "[DiffOp]") {
+    std::vector<std::tuple<std::string, std::function<ddouble(const ddouble &)>,
+                           std::function<double(double)>>>
+        funcs;
+    funcs.emplace_back("exp", leningrad::exp<double>,
+                       [](double x) { return std::exp(x); });
+    funcs.emplace_back("expm1", leningrad::expm1<double>,
+                       [](double x) { return std::exp(x); });
+    funcs.emplace_back("log", [](const ddouble &x) { return log(x); },
+                       [](double x) { return -1 / (x * x); });
+    funcs.emplace_back("log1p", leningrad::log1p<double>,
+                       [](double x) { return -1 / ((1 + x) * (1 + x)); });
+    funcs.emplace_back("square", leningrad::square<double>,
+                       [](double) { return 2.0; });
+    funcs.emplace_back("tanh", leningrad::tanh<double>, [](double x) {
+        double t = std::tanh(x);
+        return -2 * t * (1 - t * t);
+    });
+    funcs.emplace_back("sigmoid", leningrad::sigmoid<double>, [](double x) {
+        double s = 1 / (1 + std::exp(-x));
+        return s * (1 - s) * (1 - 2 * s);
+    });
+    funcs.emplace_back("softplus", leningrad::softplus<double>, [](double x) {
+        double s = 1 / (1 + std::exp(-x));
+        return s * (1 - s);
+    });
+    funcs.emplace_back("sec", leningrad::sec<double>, [](double x) {
+        double c = std::cos(x);
+        return (1 + std::sin(x) * std::sin(x)) / (c * c * c);
+    });
+    funcs.emplace_back("csc", leningrad::csc<double>, [](double x) {
+        double s = std::sin(x);
+        return (1 + std::cos(x) * std::cos(x)) / (s * s * s);
+    });
+    funcs.emplace_back("cot", leningrad::cot<double>, [](double x) {
+        double s = std::sin(x);
+        return 2 * std::cos(x) / (s * s * s);
+    });
+
+    for (const auto &tuple : funcs) {
+        for (double p : {0.3, 1.2}) {
+            ddouble x = p;
+            ddouble y = std::get<1>(tuple)(x);
+            INFO("Testing function: " << std::get<0>(tuple) << " at x=" << p);
+            REQUIRE(differentiate(y, x, 2).value() ==
+                    Approx(std::get<2>(tuple)(p)));
+        }
+    }
+}
+
+TEST_CASE("Test fma and mixed hypot", "[DiffOp]") {
+    ddouble x = 2;
+    ddouble y = -3;
+    ddouble z = 0.5;
+    ddouble w = fma(x, y, z);
+    REQUIRE(w.value() == Approx(-5.5));
+    auto dw = differentiate(w);
+    REQUIRE(dw.wrt(x).value() == Approx(-3));
+    REQUIRE(dw.wrt(y).value() == Approx(2));
+    REQUIRE(dw.wrt(z).value() == Approx(1));
+    REQUIRE(differentiate(dw.wrt(x)).wrt(y).value() == Approx(1));
+
+    ddouble h = hypot(x, 1.5) + hypot(4, y);
+    REQUIRE(h.value() == Approx(2.5 + 5));
+    auto dh = differentiate(h);
+    REQUIRE(dh.wrt(x).value() == Approx(2 / 2.5));
+    REQUIRE(dh.wrt(y).value() == Approx(-3 / 5.));
+    REQUIRE(differentiate(hypot(x, y), x, 2).value() ==
+            Approx(9 / std::pow(13, 1.5)));
+}
+
+TEST_CASE("Test fused functions are single nodes", "[DiffOp]") {
+    ddouble x = 0.7;
+    ddouble y = 1.9;
+    auto nodes = [](const ddouble &v) {
+        return impl::topologicalOrder(impl::getDiffValueNode(v)).size();
+    };
+    REQUIRE(nodes(exp(x)) == 2);
+    REQUIRE(nodes(log(x)) == 2);
+    REQUIRE(nodes(square(x)) == 2);
+    REQUIRE(nodes(tanh(x)) == 2);
+    REQUIRE(nodes(sec(x)) == 2);
+    REQUIRE(nodes(csc(x)) == 2);
+    REQUIRE(nodes(cot(x)) == 2);
+    REQUIRE(nodes(sigmoid(x)) == 2);
+    REQUIRE(nodes(softplus(x)) == 2);
+    REQUIRE(nodes(hypot(x, y)) == 3);
+    REQUIRE(nodes(fma(x, y, x)) == 3);
+
+    // the composite forms these replace
+    REQUIRE(nodes(pow(M_E, x)) == 2);
+    REQUIRE(nodes(sinh(x) / cosh(x)) == 4);
+    REQUIRE(nodes(sqrt(x * x + y * y)) == 6);
+}
+
+TEST_CASE("Fused functions Benchmark", "[DiffOp][Benchmark]") {
+    std::vector<ddouble> xs;
+    for (int i = 0; i < 100; i++) {
+        xs.emplace_back(i / 100.0);
+    }
+
+    BENCHMARK("Composite tanh") {
+        Accumulator<double> loss;
+        for (const ddouble &x : xs) {
+            loss += sinh(x) / cosh(x);
+        }
+        return gradient(loss.sum()).wrt(xs[0]);
+    };
+    BENCHMARK("Fused tanh") {
+        Accumulator<double> loss;
+        for (const ddouble &x : xs) {
+            loss += tanh(x);
+        }
+        return gradient(loss.sum()).wrt(xs[0]);
+    };
+
+    BENCHMARK("Composite sigmoid") {
+        Accumulator<double> loss;
+        for (const ddouble &x : xs) {
+            loss += 1. / (1. + pow(M_E, -x));
+        }
+        return gradient(loss.sum()).wrt(xs[0]);
+    };
+    BENCHMARK("Fused sigmoid") {
+        Accumulator<double> loss;
+        for (const ddouble &x : xs) {
+            loss += sigmoid(x);
+        }
+        return gradient(loss.sum()).wrt(xs[0]);
+    };
+
+    BENCHMARK("Composite hypot") {
+        Accumulator<double> loss;
+        for (std::size_t i = 1; i < xs.size(); i++) {
+            loss += sqrt(xs[i - 1] * xs[i - 1] + xs[i] * xs[i]);
+        }
+        return gradient(loss.sum()).wrt(xs[0]);
+    };
+    BENCHMARK("Fused hypot") {
+        Accumulator<double> loss;
+        for (std::size_t i = 1; i < xs.size(); i++) {
+            loss += hypot(xs[i - 1], xs[i]);
+        }
+        return gradient(loss.sum()).wrt(xs[0]);
+    };
+}
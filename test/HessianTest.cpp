@@ -0,0 +1,137 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "../src/Core.h"
+#include "../src/Hessian.h"
+
+using namespace leningrad;
+
+namespace {
+// a Rosenbrock-like chain, whose Hessian is tridiagonal
+ddouble chain(const std::vector<ddouble> &x) {
+    Accumulator<double> total;
+    for (std::size_t i = 0; i + 1 < x.size(); i++) {
+        total += 100 * square(x[i + 1] - x[i] * x[i]) + square(1 - x[i]);
+    }
+    return total.sum();
+}
+
+double nestedSecondDerivative(const ddouble &f, const ddouble &a,
+                              const ddouble &b) {
+    return differentiate(differentiate(f).wrt(a)).wrt(b).value();
+}
+} // namespace
+
+TEST_CASE("Test dense Hessian", "[Hessian]") {
+    ddouble x = 0.7;
+    ddouble y = -1.3;
+    ddouble z = 2.1;
+    std::vector<ddouble> inputs{x, y, z};
+    std::vector<ddouble> fs{
+        x * y * z + sin(x) * y * y,
+        x * x,
+        exp(x * y) / z + log(z) * tanh(x),
+        pow(z, x) + hypot(x, y) * sqrt(z),
+        fma(x, y, z) * sigmoid(y - z),
+        sum(inputs.begin(), inputs.end()) *
+            product(inputs.begin(), inputs.end()),
+    };
+    for (std::size_t f = 0; f < fs.size(); f++) {
+        auto h = hessian(fs[f], inputs);
+        REQUIRE(h.size() == 3);
+        for (std::size_t i = 0; i < 3; i++) {
+            INFO("Function " << f << ", input " << i);
+            REQUIRE(h.gradient()[i] ==
+                    Approx(gradient(fs[f]).wrt(inputs[i])));
+            for (std::size_t j = 0; j < 3; j++) {
+                INFO("Input " << j);
+                REQUIRE(h(i, j) ==
+                        Approx(nestedSecondDerivative(fs[f], inputs[i],
+                                                      inputs[j]))
+                            .margin(1e-12));
+            }
+        }
+    }
+}
+
+TEST_CASE("Test sparse Hessian", "[Hessian]") {
+    std::vector<ddouble> x;
+    for (int i = 0; i < 50; i++) {
+        x.emplace_back(0.1 * (i % 7) - 0.25);
+    }
+    auto h = hessian(chain(x), x);
+
+    // only the diagonal and the first subdiagonal are nonzero
+    REQUIRE(h.entries().size() == 50 + 49);
+    for (const auto &entry : h.entries()) {
+        REQUIRE(entry.row >= entry.col);
+        REQUIRE(entry.row - entry.col <= 1);
+    }
+    for (std::size_t i = 0; i < x.size(); i++) {
+        double xi = x[i].value();
+        double expected = 0;
+        if (i + 1 < x.size()) {
+            expected += 1200 * xi * xi - 400 * x[i + 1].value() + 2;
+        }
+        if (i > 0) {
+            expected += 200;
+            REQUIRE(h(i, i - 1) == Approx(-400 * x[i - 1].value()));
+            REQUIRE(h(i - 1, i) == h(i, i - 1));
+        }
+        REQUIRE(h(i, i) == Approx(expected));
+    }
+    REQUIRE(h(10, 2) == 0);
+}
+
+TEST_CASE("Test Hessian inputs", "[Hessian]") {
+    ddouble x = 1.5;
+    ddouble y = 0.5;
+    ddouble unused = 3;
+    ddouble u = x * y;
+    // an intermediate input is treated as independent of x and y
+    ddouble f = u * u + x;
+    auto h = hessian(f, {u, x, unused});
+    REQUIRE(h(0, 0) == Approx(2));
+    REQUIRE(h(1, 0) == 0);
+    REQUIRE(h(1, 1) == 0);
+    REQUIRE(h.gradient()[0] == Approx(2 * 0.75));
+    REQUIRE(h.gradient()[1] == Approx(1));
+    REQUIRE(h.gradient()[2] == 0);
+    REQUIRE(h(2, 2) == 0);
+
+    REQUIRE_THROWS_AS(hessian(f, {x, x}), std::invalid_argument);
+}
+
+TEST_CASE("Hessian Benchmark", "[Hessian][Benchmark]") {
+    std::vector<ddouble> x;
+    for (int i = 0; i < 20; i++) {
+        x.emplace_back(0.1 * i);
+    }
+    ddouble f = chain(x);
+
+    BENCHMARK("Nested differentiate") {
+        double total = 0;
+        for (const ddouble &a : x) {
+            auto da = differentiate(f).wrt(a);
+            auto dda = differentiate(da);
+            for (const ddouble &b : x) {
+                total += dda.wrt(b).value();
+            }
+        }
+        return total;
+    };
+    BENCHMARK("Edge pushing") { return hessian(f, x).entries().size(); };
+
+    std::vector<ddouble> large;
+    for (int i = 0; i < 1000; i++) {
+        large.emplace_back(0.001 * i);
+    }
+    ddouble g = chain(large);
+    BENCHMARK("Edge pushing, 1000 variables") {
+        return hessian(g, large).entries().size();
+    };
+}
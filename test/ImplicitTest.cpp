@@ -0,0 +1,118 @@
+#include <catch2/catch.hpp>
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "../src/Core.h"
+#include "../src/DiffLinearAlgebra.h"
+#include "../src/Implicit.h"
+
+using namespace leningrad;
+
+namespace {
+// solves x^2 = theta by Newton's method, taping every iteration
+ddouble tapedSqrt(const ddouble &theta, int iterations) {
+    ddouble x = 1.0;
+    for (int i = 0; i < iterations; i++) {
+        x = x - (x * x - theta) / (2 * x);
+    }
+    return x;
+}
+
+double newtonSqrt(double theta) {
+    double x = 1;
+    for (int i = 0; i < 50; i++) {
+        x -= (x * x - theta) / (2 * x);
+    }
+    return x;
+}
+} // namespace
+
+TEST_CASE("Test implicit scalar solution", "[Implicit]") {
+    ddouble theta = 3.0;
+    auto g = [](const ddouble &x, const std::vector<ddouble> &theta) {
+        return x * x - theta[0];
+    };
+    ddouble x = implicitSolution<double>(g, newtonSqrt(3.0), {theta});
+    REQUIRE(x.value() == Approx(std::sqrt(3.0)));
+    REQUIRE(gradient(x).wrt(theta) == Approx(0.5 / std::sqrt(3.0)));
+    REQUIRE(differentiate(x).wrt(theta).value() ==
+            Approx(0.5 / std::sqrt(3.0)));
+}
+
+TEST_CASE("Test implicit solution matches taped iterations", "[Implicit]") {
+    ddouble theta = 7.0;
+    ddouble taped = tapedSqrt(theta, 30);
+    auto g = [](const ddouble &x, const std::vector<ddouble> &theta) {
+        return x * x - theta[0];
+    };
+    ddouble x = implicitSolution<double>(g, newtonSqrt(7.0), {theta});
+    ddouble loss = 3 * x + sin(theta);
+    ddouble tapedLoss = 3 * taped + sin(theta);
+    REQUIRE(gradient(loss).wrt(theta) ==
+            Approx(gradient(tapedLoss).wrt(theta)));
+}
+
+TEST_CASE("Test implicit linear system", "[Implicit]") {
+    // A x = b with A = [[a, 1], [1, 2]], so x = A^-1 b
+    ddouble a = 3.0;
+    ddouble b0 = 1.0;
+    ddouble b1 = 2.0;
+    ImplicitSystem<double> g = [](const std::vector<ddouble> &x,
+                                  const std::vector<ddouble> &theta) {
+        return std::vector<ddouble>{theta[0] * x[0] + x[1] - theta[1],
+                                    x[0] + 2 * x[1] - theta[2]};
+    };
+    double det = 3.0 * 2 - 1;
+    std::vector<double> xStar{(2 * 1.0 - 2.0) / det, (3.0 * 2.0 - 1.0) / det};
+    auto x = implicitSolution(g, xStar, {a, b0, b1});
+    REQUIRE(x.size() == 2);
+
+    auto x0 = [](double a, double b0, double b1) {
+        return (2 * b0 - b1) / (2 * a - 1);
+    };
+    auto x1 = [](double a, double b0, double b1) {
+        return (a * b1 - b0) / (2 * a - 1);
+    };
+    auto grad0 = gradient(x[0]);
+    auto grad1 = gradient(x[1]);
+    // d/da of x = A^-1 b is -A^-1 (dA/da) x
+    REQUIRE(grad0.wrt(a) == Approx(-2 * x0(3, 1, 2) / det));
+    REQUIRE(grad1.wrt(a) == Approx(x0(3, 1, 2) / det));
+    REQUIRE(grad0.wrt(b0) == Approx(2 / det));
+    REQUIRE(grad0.wrt(b1) == Approx(-1 / det));
+    REQUIRE(grad1.wrt(b0) == Approx(-1 / det));
+    REQUIRE(grad1.wrt(b1) == Approx(3 / det));
+    REQUIRE(x[1].value() == Approx(x1(3, 1, 2)));
+}
+
+TEST_CASE("Test implicit system size mismatch", "[Implicit]") {
+    ddouble theta = 1.0;
+    ImplicitSystem<double> g = [](const std::vector<ddouble> &x,
+                                  const std::vector<ddouble> &theta) {
+        return std::vector<ddouble>{x[0] - theta[0], x[1] - theta[0],
+                                    x[0] - x[1]};
+    };
+    auto x = implicitSolution(g, {1.0, 1.0}, {theta});
+    REQUIRE_THROWS_AS(gradient(x[0]), std::invalid_argument);
+}
+
+TEST_CASE("Test LU factorization", "[Implicit]") {
+    impl::LUFactorization<double> lu({0, 2, 1, 1, 1, 0, 3, 0, 1}, 3);
+    // det = 0*(1-0) - 2*(1-0) + 1*(0-3) = -5
+    REQUIRE(lu.determinantSign() == -1);
+    REQUIRE(lu.logAbsDeterminant() == Approx(std::log(5.0)));
+    std::vector<double> b{3, 2, 4};
+    lu.solve(b.data());
+    REQUIRE(b[0] == Approx(1));
+    REQUIRE(b[1] == Approx(1));
+    REQUIRE(b[2] == Approx(1));
+    std::vector<double> c{4, 3, 2};
+    lu.solveTransposed(c.data());
+    REQUIRE(c[0] == Approx(1));
+    REQUIRE(c[1] == Approx(1));
+    REQUIRE(c[2] == Approx(1));
+    REQUIRE_THROWS_AS(impl::LUFactorization<double>({1, 2, 2, 4}, 2),
+                      std::domain_error);
+}
@@ -0,0 +1,347 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include "../src/Core.h"
+#include "../src/DiffLinearAlgebra.h"
+#include "../src/Hessian.h"
+
+using namespace leningrad;
+
+namespace {
+std::vector<ddouble> makeMatrix(std::size_t n, bool symmetric) {
+    std::vector<ddouble> a;
+    for (std::size_t i = 0; i < n; i++) {
+        for (std::size_t j = 0; j < n; j++) {
+            std::size_t r = symmetric ? std::max(i, j) : i;
+            std::size_t c = symmetric ? std::min(i, j) : j;
+            double value = std::sin(1.0 + 3.0 * r + 7.0 * c);
+            a.emplace_back(r == c ? value + n : value);
+        }
+    }
+    return a;
+}
+
+std::vector<ddouble> makeVector(std::size_t n) {
+    std::vector<ddouble> b;
+    for (std::size_t i = 0; i < n; i++) {
+        b.emplace_back(std::cos(2.0 * i));
+    }
+    return b;
+}
+
+// Gaussian elimination with partial pivoting, recorded node by node
+std::vector<ddouble> naiveSolve(std::vector<ddouble> a,
+                                std::vector<ddouble> b) {
+    std::size_t n = b.size();
+    for (std::size_t k = 0; k < n; k++) {
+        std::size_t pivot = k;
+        for (std::size_t i = k + 1; i < n; i++) {
+            if (std::abs(a[i * n + k].value()) >
+                std::abs(a[pivot * n + k].value())) {
+                pivot = i;
+            }
+        }
+        for (std::size_t j = 0; j < n; j++) {
+            std::swap(a[k * n + j], a[pivot * n + j]);
+        }
+        std::swap(b[k], b[pivot]);
+        for (std::size_t i = k + 1; i < n; i++) {
+            ddouble factor = a[i * n + k] / a[k * n + k];
+            for (std::size_t j = k + 1; j < n; j++) {
+                a[i * n + j] = a[i * n + j] - factor * a[k * n + j];
+            }
+            b[i] = b[i] - factor * b[k];
+        }
+    }
+    std::vector<ddouble> x(n, 0.0);
+    for (std::size_t i = n; i-- > 0;) {
+        ddouble total = b[i];
+        for (std::size_t j = i + 1; j < n; j++) {
+            total = total - a[i * n + j] * x[j];
+        }
+        x[i] = total / a[i * n + i];
+    }
+    return x;
+}
+
+// the product of the pivots, up to sign
+ddouble naiveDeterminant(std::vector<ddouble> u, std::size_t n) {
+    ddouble det = 1;
+    for (std::size_t k = 0; k < n; k++) {
+        for (std::size_t i = k + 1; i < n; i++) {
+            ddouble factor = u[i * n + k] / u[k * n + k];
+            for (std::size_t j = k + 1; j < n; j++) {
+                u[i * n + j] = u[i * n + j] - factor * u[k * n + j];
+            }
+        }
+        det = det * u[k * n + k];
+    }
+    return det;
+}
+
+// reads only the lower triangle of a
+std::vector<ddouble> naiveCholesky(const std::vector<ddouble> &a,
+                                   std::size_t n) {
+    std::vector<ddouble> l(n * n, 0.0);
+    for (std::size_t j = 0; j < n; j++) {
+        ddouble d = a[j * n + j];
+        for (std::size_t k = 0; k < j; k++) {
+            d = d - l[j * n + k] * l[j * n + k];
+        }
+        l[j * n + j] = sqrt(d);
+        for (std::size_t i = j + 1; i < n; i++) {
+            ddouble total = a[i * n + j];
+            for (std::size_t k = 0; k < j; k++) {
+                total = total - l[i * n + k] * l[j * n + k];
+            }
+            l[i * n + j] = total / l[j * n + j];
+        }
+    }
+    return l;
+}
+
+ddouble weightedSum(const std::vector<ddouble> &xs) {
+    ddouble total = 0;
+    for (std::size_t i = 0; i < xs.size(); i++) {
+        total = total + std::cos(0.5 * i) * xs[i];
+    }
+    return total;
+}
+
+std::size_t nodeCount(const ddouble &value) {
+    return impl::topologicalOrder(impl::getDiffValueNode(value)).size();
+}
+
+void requireSameGradient(const ddouble &expected, const ddouble &actual,
+                         const std::vector<ddouble> &inputs) {
+    REQUIRE(actual.value() == Approx(expected.value()));
+    auto expectedGradient = gradient(expected);
+    auto actualGradient = gradient(actual);
+    for (const ddouble &input : inputs) {
+        REQUIRE(actualGradient.wrt(input) ==
+                Approx(expectedGradient.wrt(input)).margin(1e-12));
+    }
+}
+
+void requireSameSecondDerivatives(const ddouble &expected,
+                                  const ddouble &actual,
+                                  const std::vector<ddouble> &inputs) {
+    for (std::size_t u = 0; u < inputs.size(); u += 2) {
+        for (std::size_t v = 0; v <= u; v += 3) {
+            INFO("Second derivative wrt inputs " << u << " and " << v);
+            double value =
+                differentiate(actual, {inputs[u], inputs[v]}).value();
+            REQUIRE(value ==
+                    Approx(differentiate(expected, {inputs[u], inputs[v]})
+                               .value())
+                        .margin(1e-10));
+        }
+    }
+}
+} // namespace
+
+TEST_CASE("Test Linear Solve", "[LinearAlgebra]") {
+    std::size_t n = 6;
+    auto a = makeMatrix(n, false);
+    auto b = makeVector(n);
+    std::vector<ddouble> inputs = a;
+    inputs.insert(inputs.end(), b.begin(), b.end());
+
+    ddouble expected = weightedSum(naiveSolve(a, b));
+    ddouble actual = weightedSum(solve(a, b));
+    requireSameGradient(expected, actual, inputs);
+
+    // symbolic derivatives agree too
+    auto dx = differentiate(actual);
+    REQUIRE(dx.wrt(a[7]).value() == Approx(gradient(expected).wrt(a[7])));
+
+    REQUIRE(nodeCount(actual) < nodeCount(expected));
+    REQUIRE_THROWS_AS(solve(a, makeVector(n - 1)), std::invalid_argument);
+    std::vector<ddouble> singular(n * n, 1.0);
+    REQUIRE_THROWS_AS(solve(singular, b), std::domain_error);
+}
+
+TEST_CASE("Test Inverse", "[LinearAlgebra]") {
+    std::size_t n = 5;
+    auto a = makeMatrix(n, false);
+    auto x = inverse(a);
+
+    // the columns of the inverse solve A x = e_i
+    std::vector<ddouble> expectedInverse(n * n, 0.0);
+    for (std::size_t c = 0; c < n; c++) {
+        std::vector<ddouble> e(n, 0.0);
+        e[c] = 1.0;
+        auto column = naiveSolve(a, e);
+        for (std::size_t r = 0; r < n; r++) {
+            expectedInverse[r * n + c] = column[r];
+        }
+    }
+    requireSameGradient(weightedSum(expectedInverse), weightedSum(x), a);
+
+    REQUIRE_THROWS_AS(inverse(std::vector<ddouble>(7, 1.0)),
+                      std::invalid_argument);
+}
+
+TEST_CASE("Test Determinant", "[LinearAlgebra]") {
+    std::size_t n = 5;
+    auto a = makeMatrix(n, false);
+
+    ddouble expected = naiveDeterminant(a, n);
+
+    ddouble det = determinant(a);
+    requireSameGradient(expected, det, a);
+    REQUIRE(nodeCount(det) == n * n + 1);
+
+    ddouble logDet = logAbsDeterminant(a);
+    requireSameGradient(log(abs(expected)), logDet, a);
+
+    // swapping two rows flips the sign
+    std::vector<ddouble> swapped = a;
+    for (std::size_t j = 0; j < n; j++) {
+        std::swap(swapped[j], swapped[n + j]);
+    }
+    REQUIRE(determinant(swapped).value() == Approx(-det.value()));
+}
+
+TEST_CASE("Test Cholesky", "[LinearAlgebra]") {
+    SECTION("Against Elimination") {
+        std::size_t n = 6;
+        auto a = makeMatrix(n, true);
+        auto l = cholesky(a);
+        auto expected = naiveCholesky(a, n);
+        for (std::size_t i = 0; i < n; i++) {
+            for (std::size_t j = i + 1; j < n; j++) {
+                REQUIRE(l[i * n + j].value() == 0);
+            }
+        }
+        requireSameGradient(weightedSum(expected), weightedSum(l), a);
+    }
+
+    SECTION("Blocked Factorization") {
+        // spans several blocks, including a partial one
+        std::size_t n = 2 * impl::CholeskyFactorization<double>::blockSize + 5;
+        std::vector<double> a(n * n);
+        for (std::size_t i = 0; i < n; i++) {
+            for (std::size_t j = 0; j <= i; j++) {
+                a[i * n + j] = a[j * n + i] =
+                    i == j ? n : std::sin(1.0 + 3.0 * i + 7.0 * j);
+            }
+        }
+        impl::CholeskyFactorization<double> factorization(a, n);
+        const auto &l = factorization.lower();
+        for (std::size_t i = 0; i < n; i++) {
+            for (std::size_t j = 0; j < n; j++) {
+                double product = 0;
+                for (std::size_t k = 0; k < n; k++) {
+                    product += l[i * n + k] * l[j * n + k];
+                }
+                REQUIRE(product == Approx(a[i * n + j]).margin(1e-12));
+            }
+        }
+    }
+
+    SECTION("Not Positive Definite") {
+        std::vector<ddouble> a{1.0, 2.0, 2.0, 1.0};
+        REQUIRE_THROWS_AS(cholesky(a), std::domain_error);
+    }
+}
+
+TEST_CASE("Test Linear Algebra Higher Derivatives", "[LinearAlgebra]") {
+    std::size_t n = 3;
+
+    SECTION("Solve") {
+        auto a = makeMatrix(n, false);
+        auto b = makeVector(n);
+        std::vector<ddouble> inputs = a;
+        inputs.insert(inputs.end(), b.begin(), b.end());
+        requireSameSecondDerivatives(weightedSum(naiveSolve(a, b)),
+                                     weightedSum(solve(a, b)), inputs);
+
+        // x = b / a
+        ddouble a1 = 2;
+        ddouble b1 = 3;
+        ddouble x = solve<double>({a1}, {b1})[0];
+        REQUIRE(differentiate(x, a1, 3).value() == Approx(-6 * 3.0 / 16));
+    }
+
+    SECTION("Inverse") {
+        auto a = makeMatrix(n, false);
+        std::vector<ddouble> e(n * n, 0.0);
+        for (std::size_t i = 0; i < n; i++) {
+            e[i * n + i] = 1.0;
+        }
+        // the inverse solves A X = I column by column
+        std::vector<ddouble> expected(n * n, 0.0);
+        for (std::size_t c = 0; c < n; c++) {
+            std::vector<ddouble> column(e.begin() + c * n,
+                                        e.begin() + (c + 1) * n);
+            auto x = naiveSolve(a, column);
+            for (std::size_t r = 0; r < n; r++) {
+                expected[r * n + c] = x[r];
+            }
+        }
+        requireSameSecondDerivatives(weightedSum(expected),
+                                     weightedSum(inverse(a)), a);
+    }
+
+    SECTION("Determinants") {
+        auto a = makeMatrix(n, false);
+        ddouble expected = naiveDeterminant(a, n);
+        requireSameSecondDerivatives(expected, determinant(a), a);
+        requireSameSecondDerivatives(log(abs(expected)), logAbsDeterminant(a),
+                                     a);
+    }
+
+    SECTION("Cholesky") {
+        auto a = makeMatrix(n, true);
+        requireSameSecondDerivatives(weightedSum(naiveCholesky(a, n)),
+                                     weightedSum(cholesky(a)), a);
+    }
+
+    SECTION("Hessian") {
+        // edge pushing works where each node's partials only depend on its
+        // children, as for determinants and Cholesky factors
+        auto a = makeMatrix(n, true);
+        auto expected = hessian(naiveDeterminant(a, n), a);
+        auto actual = hessian(determinant(a), a);
+        auto expectedCholesky = hessian(weightedSum(naiveCholesky(a, n)), a);
+        auto actualCholesky = hessian(weightedSum(cholesky(a)), a);
+        for (std::size_t i = 0; i < n * n; i++) {
+            for (std::size_t j = 0; j <= i; j++) {
+                REQUIRE(actual(i, j) == Approx(expected(i, j)).margin(1e-10));
+                REQUIRE(actualCholesky(i, j) ==
+                        Approx(expectedCholesky(i, j)).margin(1e-10));
+            }
+        }
+        REQUIRE_THROWS_AS(hessian(weightedSum(solve(a, makeVector(n))), a),
+                          std::domain_error);
+    }
+}
+
+TEST_CASE("Linear Algebra Benchmark", "[LinearAlgebra][Benchmark]") {
+    std::size_t n = 24;
+    auto a = makeMatrix(n, true);
+    auto b = makeVector(n);
+
+    BENCHMARK("Elimination Solve And Gradient") {
+        return gradient(weightedSum(naiveSolve(a, b))).wrt(a[0]);
+    };
+
+    BENCHMARK("solve() And Gradient") {
+        return gradient(weightedSum(solve(a, b))).wrt(a[0]);
+    };
+
+    BENCHMARK("Elimination Cholesky And Gradient") {
+        return gradient(weightedSum(naiveCholesky(a, n))).wrt(a[0]);
+    };
+
+    BENCHMARK("cholesky() And Gradient") {
+        return gradient(weightedSum(cholesky(a))).wrt(a[0]);
+    };
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+// Counts the blocks, and the bytes, allocated through it and not yet freed,
+// and all the blocks it ever allocated.
+class LiveCountingResource : public std::pmr::memory_resource {
+public:
+    long live = 0;
+    std::size_t liveBytes = 0;
+    long allocated = 0;
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        live++;
+        liveBytes += bytes;
+        allocated++;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, std::size_t bytes,
+                       std::size_t alignment) override {
+        live--;
+        liveBytes -= bytes;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const
+        noexcept override {
+        return this == &other;
+    }
+};
@@ -0,0 +1,152 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <memory_resource>
+#include <thread>
+#include <vector>
+
+#include "../src/Core.h"
+
+using namespace leningrad;
+
+namespace {
+class CountingResource : public std::pmr::memory_resource {
+public:
+    std::size_t allocations = 0;
+    std::size_t deallocations = 0;
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        allocations++;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, std::size_t bytes,
+                       std::size_t alignment) override {
+        deallocations++;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const
+        noexcept override {
+        return this == &other;
+    }
+};
+} // namespace
+
+TEST_CASE("Test custom node resource", "[NodeAllocator]") {
+    CountingResource resource;
+    {
+        NodeResourceScope scope(&resource);
+        ddouble x = 2;
+        ddouble y = x * x + sin(x);
+        REQUIRE(resource.allocations == 4);
+        REQUIRE(getNodeResource() == &resource);
+        REQUIRE(differentiate(y).wrt(x).value() ==
+                Approx(4 + std::cos(2.0)));
+    }
+    REQUIRE(getNodeResource() == defaultNodeResource());
+    REQUIRE(resource.allocations > 4);
+    REQUIRE(resource.allocations == resource.deallocations);
+}
+
+TEST_CASE("Test nodes outliving their scope", "[NodeAllocator]") {
+    CountingResource resource;
+    ddouble y;
+    {
+        NodeResourceScope scope(&resource);
+        ddouble x = 3;
+        y = x * 2.;
+    }
+    ddouble z = y + 1.;
+    REQUIRE(z.value() == 7);
+    REQUIRE(resource.allocations == 2);
+    y = 0;
+    REQUIRE(resource.deallocations == 0);
+    z = 0;
+    REQUIRE(resource.deallocations == 2);
+}
+
+TEST_CASE("Test monotonic arena", "[NodeAllocator]") {
+    std::pmr::monotonic_buffer_resource arena;
+    NodeResourceScope scope(&arena);
+    for (int i = 0; i < 3; i++) {
+        ddouble x = i;
+        ddouble y = exp(x) * x;
+        REQUIRE(differentiate(y).wrt(x).value() ==
+                Approx(std::exp(i) * (i + 1)));
+    }
+}
+
+TEST_CASE("Test pool across threads", "[NodeAllocator]") {
+    std::vector<ddouble> values;
+    std::thread producer([&values]() {
+        for (int i = 0; i < 10000; i++) {
+            ddouble x = i;
+            values.push_back(x * 2.);
+        }
+    });
+    producer.join();
+    for (int i = 0; i < 10000; i++) {
+        REQUIRE(values[i].value() == 2. * i);
+    }
+    std::thread consumer([&values]() { values.clear(); });
+    consumer.join();
+
+    ddouble x = 1;
+    REQUIRE((x + x).value() == 2);
+}
+
+namespace {
+// built before the pool's cache on its thread, so destroyed after it
+struct ExitGraph {
+    std::vector<ddouble> values;
+
+    ~ExitGraph() {
+        // nodes are both freed and created after the cache is gone
+        ddouble x = 3;
+        values.push_back(x * x);
+        values.clear();
+    }
+};
+} // namespace
+
+TEST_CASE("Test pool edge cases", "[NodeAllocator]") {
+    std::pmr::memory_resource *pool = defaultNodeResource();
+    void *empty = pool->allocate(0, 1);
+    void *other = pool->allocate(0, 1);
+    REQUIRE(empty != other);
+    pool->deallocate(empty, 0, 1);
+    pool->deallocate(other, 0, 1);
+
+    std::thread exiting([]() {
+        thread_local ExitGraph graph;
+        for (int i = 0; i < 1000; i++) {
+            ddouble x = i;
+            graph.values.push_back(x * 2.);
+        }
+    });
+    exiting.join();
+    ddouble x = 1;
+    REQUIRE((x * 2.).value() == 2);
+}
+
+TEST_CASE("Node Allocation Benchmark", "[NodeAllocator][Benchmark]") {
+    ddouble a = 1.5;
+    BENCHMARK("Default pool") {
+        ddouble z = 0;
+        for (int i = 0; i < 1000; i++) {
+            z += a * a;
+        }
+        return z;
+    };
+
+    BENCHMARK("Global new/delete") {
+        NodeResourceScope scope(std::pmr::new_delete_resource());
+        ddouble z = 0;
+        for (int i = 0; i < 1000; i++) {
+            z += a * a;
+        }
+        return z;
+    };
+}
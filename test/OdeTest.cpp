@@ -0,0 +1,136 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include "../src/Core.h"
+#include "../src/Ode.h"
+#include "LiveCountingResource.h"
+
+using namespace leningrad;
+
+namespace {
+// Lotka-Volterra, with theta = (alpha, beta, delta, gamma)
+std::vector<ddouble> predatorPrey(double, const std::vector<ddouble> &y,
+                                  const std::vector<ddouble> &theta) {
+    return {theta[0] * y[0] - theta[1] * y[0] * y[1],
+            theta[2] * y[0] * y[1] - theta[3] * y[1]};
+}
+
+// the whole integration, recorded node by node
+std::vector<ddouble> tapedRK4(const std::vector<ddouble> &y0,
+                              const std::vector<ddouble> &theta, double t0,
+                              double t1, std::size_t steps) {
+    OdeFunction<double> f = predatorPrey;
+    std::vector<ddouble> y = y0;
+    double h = (t1 - t0) / steps;
+    double t = t0;
+    for (std::size_t s = 0; s < steps; s++) {
+        y = impl::rungeKuttaStep(impl::rk4Tableau(), f, t, h, y, theta);
+        t += h;
+    }
+    return y;
+}
+
+ddouble loss(const std::vector<ddouble> &y) { return y[0] + 2 * y[1]; }
+} // namespace
+
+TEST_CASE("Test RK4 Adjoint", "[Ode]") {
+    std::vector<ddouble> y0{1.0, 0.5};
+    std::vector<ddouble> theta{1.1, 0.4, 0.1, 0.4};
+    std::vector<ddouble> inputs{y0[0], y0[1], theta[0], theta[1],
+                                theta[2], theta[3]};
+    auto taped = loss(tapedRK4(y0, theta, 0, 5, 200));
+    auto expected = gradient(taped);
+
+    for (std::size_t interval : {1, 7, 32, 1000}) {
+        auto y = integrateRK4<double>(predatorPrey, y0, theta, 0, 5, 200,
+                                      interval);
+        ddouble actual = loss(y);
+        REQUIRE(actual.value() == Approx(taped.value()).epsilon(1e-12));
+        auto grad = gradient(actual);
+        for (const ddouble &input : inputs) {
+            REQUIRE(grad.wrt(input) ==
+                    Approx(expected.wrt(input)).epsilon(1e-10));
+        }
+    }
+}
+
+TEST_CASE("Test Dormand-Prince Adjoint", "[Ode]") {
+    SECTION("Exponential Decay") {
+        ddouble y0 = 2;
+        ddouble k = 0.7;
+        OdeFunction<double> f = [](double, const std::vector<ddouble> &y,
+                                   const std::vector<ddouble> &theta) {
+            return std::vector<ddouble>{-theta[0] * y[0]};
+        };
+        auto y = integrateDormandPrince(f, {y0}, {k}, 0.0, 3.0, 1e-10, 1e-12);
+        double exact = 2 * std::exp(-0.7 * 3);
+        REQUIRE(y[0].value() == Approx(exact).epsilon(1e-8));
+        auto grad = gradient(y[0]);
+        REQUIRE(grad.wrt(y0) == Approx(exact / 2).epsilon(1e-8));
+        REQUIRE(grad.wrt(k) == Approx(-3 * exact).epsilon(1e-8));
+    }
+
+    SECTION("Against Taping") {
+        std::vector<ddouble> y0{1.0, 0.5};
+        std::vector<ddouble> theta{1.1, 0.4, 0.1, 0.4};
+        auto expected = gradient(loss(tapedRK4(y0, theta, 0, 5, 2000)));
+        auto y = integrateDormandPrince<double>(predatorPrey, y0, theta, 0, 5,
+                                                1e-9, 1e-12);
+        auto grad = gradient(loss(y));
+        for (const ddouble &input : {y0[0], y0[1], theta[0], theta[3]}) {
+            REQUIRE(grad.wrt(input) ==
+                    Approx(expected.wrt(input)).epsilon(1e-6));
+        }
+    }
+
+    SECTION("Errors") {
+        std::vector<ddouble> y0{1.0, 0.5};
+        std::vector<ddouble> theta{1.1, 0.4, 0.1, 0.4};
+        REQUIRE_THROWS_AS(integrateDormandPrince<double>(predatorPrey, y0,
+                                                         theta, 1, 0),
+                          std::invalid_argument);
+        OdeFunction<double> wrongSize = [](double, const auto &,
+                                           const auto &theta) { return theta; };
+        REQUIRE_THROWS_AS(
+            integrateRK4<double>(wrongSize, y0, theta, 0, 1, 10),
+            std::invalid_argument);
+    }
+}
+
+TEST_CASE("Test ODE Adjoint Memory", "[Ode]") {
+    std::vector<long> live;
+    for (std::size_t steps : {100, 1000}) {
+        LiveCountingResource resource;
+        {
+            NodeResourceScope scope(&resource);
+            std::vector<ddouble> y0{1.0, 0.5};
+            std::vector<ddouble> theta{1.1, 0.4, 0.1, 0.4};
+            auto y = integrateRK4<double>(predatorPrey, y0, theta, 0, 5,
+                                          steps);
+            auto grad = gradient(loss(y));
+            REQUIRE(grad.wrt(theta[0]) != 0);
+            live.push_back(resource.live);
+        }
+    }
+    // the graph doesn't grow with the number of steps
+    REQUIRE(live[0] == live[1]);
+}
+
+TEST_CASE("ODE Adjoint Benchmark", "[Ode][Benchmark]") {
+    std::vector<ddouble> y0{1.0, 0.5};
+    std::vector<ddouble> theta{1.1, 0.4, 0.1, 0.4};
+
+    BENCHMARK("Taped RK4 And Gradient") {
+        return gradient(loss(tapedRK4(y0, theta, 0, 5, 500))).wrt(theta[0]);
+    };
+
+    BENCHMARK("Adjoint RK4 And Gradient") {
+        auto y = integrateRK4<double>(predatorPrey, y0, theta, 0, 5, 500);
+        return gradient(loss(y)).wrt(theta[0]);
+    };
+}
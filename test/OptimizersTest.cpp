@@ -0,0 +1,108 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include "../src/Core.h"
+#include "../src/Optimizers.h"
+
+using namespace leningrad;
+
+namespace {
+ddouble rosenbrock(const VariableRegistry<double> &x) {
+    std::vector<ddouble> terms;
+    terms.reserve(2 * (x.size() - 1));
+    for (std::size_t i = 0; i + 1 < x.size(); i++) {
+        terms.push_back(100 * square(x[i + 1] - square(x[i])));
+        terms.push_back(square(1 - x[i]));
+    }
+    return sum(terms.begin(), terms.end());
+}
+
+// minimized at x_i = i
+ddouble quadratic(const VariableRegistry<double> &x) {
+    ddouble total = 0;
+    for (std::size_t i = 0; i < x.size(); i++) {
+        total = total + (i + 1) * square(x[i] - double(i));
+    }
+    return total;
+}
+
+template <typename Optimizer>
+double minimize(Optimizer &optimizer, const Objective<double> &f,
+                int steps) {
+    double value = 0;
+    for (int i = 0; i < steps; i++) {
+        value = optimizer.step(f);
+    }
+    return value;
+}
+
+void requireNear(const std::vector<double> &x, double margin) {
+    for (std::size_t i = 0; i < x.size(); i++) {
+        REQUIRE(x[i] == Approx(double(i)).margin(margin));
+    }
+}
+} // namespace
+
+TEST_CASE("Test SGD", "[Optimizers]") {
+    SGD<double> optimizer(std::vector<double>(5, 0.0), 0.02);
+    double first = optimizer.step(quadratic);
+    REQUIRE(first == Approx(1 * 0 + 2 * 1 + 3 * 4 + 4 * 9 + 5 * 16));
+    // the first step is plain gradient descent
+    REQUIRE(optimizer.parameters()[1] == Approx(0.02 * 2 * 2 * 1));
+    minimize(optimizer, quadratic, 300);
+    requireNear(optimizer.parameters(), 1e-6);
+}
+
+TEST_CASE("Test Adam", "[Optimizers]") {
+    Adam<double> optimizer(std::vector<double>(5, 0.0), 0.05);
+    optimizer.step(quadratic);
+    // bias correction makes the first step learningRate * sign(grad)
+    REQUIRE(optimizer.parameters()[0] == 0);
+    REQUIRE(optimizer.parameters()[3] == Approx(0.05));
+    minimize(optimizer, quadratic, 2000);
+    requireNear(optimizer.parameters(), 1e-4);
+}
+
+TEST_CASE("Test L-BFGS", "[Optimizers]") {
+    SECTION("Quadratic") {
+        LBFGS<double> optimizer(std::vector<double>(5, 0.0));
+        minimize(optimizer, quadratic, 30);
+        requireNear(optimizer.parameters(), 1e-8);
+    }
+
+    SECTION("Rosenbrock") {
+        std::vector<double> start(10, -1.0);
+        LBFGS<double> optimizer(start);
+        double value = minimize(optimizer, rosenbrock, 200);
+        REQUIRE(value == Approx(0).margin(1e-12));
+        for (double x : optimizer.parameters()) {
+            REQUIRE(x == Approx(1).margin(1e-6));
+        }
+        // at the minimum, steps no longer move
+        REQUIRE(optimizer.step(rosenbrock) == Approx(0).margin(1e-12));
+    }
+
+    REQUIRE_THROWS_AS(LBFGS<double>({1.0}, 0), std::invalid_argument);
+}
+
+TEST_CASE("Optimizer Benchmark", "[Optimizers][Benchmark]") {
+    std::vector<double> start(1000, -1.0);
+    SGD<double> sgd(start, 1e-4);
+    Adam<double> adam(start, 1e-3);
+    LBFGS<double> lbfgs(start);
+
+    BENCHMARK("SGD Step, 1000-D Rosenbrock") { return sgd.step(rosenbrock); };
+
+    BENCHMARK("Adam Step, 1000-D Rosenbrock") {
+        return adam.step(rosenbrock);
+    };
+
+    BENCHMARK("L-BFGS Step, 1000-D Rosenbrock") {
+        return lbfgs.step(rosenbrock);
+    };
+}
@@ -0,0 +1,120 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <cmath>
+#include <vector>
+
+#include "../src/Core.h"
+#include "../src/Primitive.h"
+
+using namespace leningrad;
+
+namespace {
+// a piecewise linear interpolant of sin over a table, as a single node
+ddouble tableSin(const ddouble &x) {
+    static std::vector<double> table = []() {
+        std::vector<double> t;
+        for (int i = 0; i <= 100; i++) {
+            t.push_back(std::sin(i * 0.1));
+        }
+        return t;
+    }();
+    double pos = x.value() / 0.1;
+    auto i = static_cast<std::size_t>(pos);
+    double slope = (table[i + 1] - table[i]) / 0.1;
+    return primitive(table[i] + (pos - i) * (table[i + 1] - table[i]), {x},
+                     {slope});
+}
+
+ddouble mySin(const ddouble &x) {
+    return primitive<double>(
+        std::sin(x.value()), {x}, {std::cos(x.value())},
+        [](const std::vector<ddouble> &inputs, std::size_t) {
+            return cos(inputs[0]);
+        });
+}
+
+ddouble weightedNorm(const ddouble &x, const ddouble &y, double w) {
+    double r = std::sqrt(w * x.value() * x.value() + y.value() * y.value());
+    return primitive(r, {x, y}, {w * x.value() / r, y.value() / r});
+}
+
+// a statement with two inputs and many intermediate nodes
+ddouble statement(const std::vector<ddouble> &in) {
+    ddouble acc = in[0];
+    for (int i = 0; i < 20; i++) {
+        acc = sin(acc) * in[1] + acc / (1 + in[0] * in[0]);
+    }
+    return acc;
+}
+} // namespace
+
+TEST_CASE("Test first order primitives", "[Primitive]") {
+    ddouble x = 0.73;
+    ddouble y = tableSin(x);
+    REQUIRE(y.value() == Approx(std::sin(0.73)).margin(1e-3));
+    REQUIRE(differentiate(y).wrt(x).value() ==
+            Approx((std::sin(0.8) - std::sin(0.7)) / 0.1));
+    REQUIRE(differentiate(y, x, 2).value() == 0);
+
+    ddouble a = 3;
+    ddouble b = 4;
+    ddouble c = 2 * weightedNorm(a, b, 1) + a;
+    REQUIRE(c.value() == Approx(13));
+    auto grad = gradient(c);
+    REQUIRE(grad.wrt(a) == Approx(2 * 3 / 5. + 1));
+    REQUIRE(grad.wrt(b) == Approx(2 * 4 / 5.));
+}
+
+TEST_CASE("Test higher order primitives", "[Primitive]") {
+    ddouble x = 1.2;
+    ddouble y = mySin(x) * x;
+    REQUIRE(differentiate(y).wrt(x).value() ==
+            Approx(std::cos(1.2) * 1.2 + std::sin(1.2)));
+    REQUIRE(differentiate(y, x, 2).value() ==
+            Approx(-std::sin(1.2) * 1.2 + 2 * std::cos(1.2)));
+}
+
+TEST_CASE("Test mismatched primitive partials", "[Primitive]") {
+    ddouble x = 1;
+    REQUIRE_THROWS_AS(primitive(1., {x}, {}), std::invalid_argument);
+}
+
+TEST_CASE("Test preaccumulation", "[Primitive]") {
+    ddouble x = 0.4;
+    ddouble y = 1.3;
+    ddouble direct = exp(statement({x, y})) * y;
+    ddouble compact = exp(preaccumulate<double>({x, y}, statement)) * y;
+    REQUIRE(compact.value() == Approx(direct.value()));
+
+    auto directGrad = gradient(direct);
+    auto compactGrad = gradient(compact);
+    REQUIRE(compactGrad.wrt(x) == Approx(directGrad.wrt(x)));
+    REQUIRE(compactGrad.wrt(y) == Approx(directGrad.wrt(y)));
+    REQUIRE(differentiate(compact).wrt(x).value() ==
+            Approx(directGrad.wrt(x)));
+
+    auto directSize = impl::topologicalOrder(impl::getDiffValueNode(direct))
+                          .size();
+    auto compactSize = impl::topologicalOrder(impl::getDiffValueNode(compact))
+                           .size();
+    // exp, *, the preaccumulated node and the two inputs
+    REQUIRE(compactSize == 5);
+    REQUIRE(compactSize * 10 < directSize);
+}
+
+TEST_CASE("Benchmark preaccumulation", "[Primitive][Benchmark]") {
+    ddouble x = 0.4;
+    ddouble y = 1.3;
+    ddouble direct = 0;
+    ddouble compact = 0;
+    for (int i = 0; i < 100; i++) {
+        direct += statement({x, y});
+        compact += preaccumulate<double>({x, y}, statement);
+    }
+
+    BENCHMARK("Gradient of the full graph") { return gradient(direct); };
+    BENCHMARK("Gradient of the preaccumulated graph") {
+        return gradient(compact);
+    };
+}
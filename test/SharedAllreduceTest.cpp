@@ -0,0 +1,170 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/Core.h"
+#include "../src/SharedAllreduce.h"
+#include "../src/VariableRegistry.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace leningrad;
+
+namespace {
+std::string segmentName(const std::string &test) {
+    return "/leningrad_" + test + "_" + std::to_string(getpid());
+}
+
+// runs worker(rank) in worldSize child processes, and returns how many of
+// them failed
+int forkWorkers(std::size_t worldSize,
+                const std::function<bool(std::size_t)> &worker) {
+    std::vector<pid_t> children;
+    for (std::size_t rank = 0; rank < worldSize; rank++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            bool ok = false;
+            try {
+                ok = worker(rank);
+            } catch (...) {
+            }
+            _exit(ok ? 0 : 1);
+        }
+        children.push_back(pid);
+    }
+    int failures = 0;
+    for (pid_t pid : children) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failures++;
+        }
+    }
+    return failures;
+}
+
+// every worker sums all the slots itself, for comparison
+void naiveAllreduce(std::vector<std::vector<double>> &slots,
+                    impl::SpinBarrier &barrier, std::size_t rank,
+                    std::vector<double> &data) {
+    std::size_t worldSize = slots.size();
+    std::copy(data.begin(), data.end(), slots[rank].begin());
+    barrier.wait(worldSize);
+    for (std::size_t i = 0; i < data.size(); i++) {
+        double total = slots[0][i];
+        for (std::size_t r = 1; r < worldSize; r++) {
+            total += slots[r][i];
+        }
+        data[i] = total;
+    }
+    barrier.wait(worldSize);
+}
+} // namespace
+
+TEST_CASE("Test shared allreduce across processes", "[SharedAllreduce]") {
+    std::string name = segmentName("sum");
+    std::size_t worldSize = 4;
+    // not a multiple of the world size, so chunks are uneven
+    std::size_t count = 1001;
+    int failures = forkWorkers(worldSize, [&](std::size_t rank) {
+        SharedAllreduce<double> reducer(name, rank, worldSize, count);
+        bool ok = true;
+        for (int round = 0; round < 5; round++) {
+            std::vector<double> data(count);
+            for (std::size_t i = 0; i < count; i++) {
+                data[i] = static_cast<double>(rank * 1000 + i + round);
+            }
+            reducer.allreduce(data.data());
+            for (std::size_t i = 0; i < count; i++) {
+                // sum over ranks of rank * 1000 + i + round
+                ok = ok && data[i] == 6000.0 + 4.0 * (i + round);
+            }
+        }
+        return ok;
+    });
+    REQUIRE(failures == 0);
+}
+
+TEST_CASE("Test shared gradient aggregation", "[SharedAllreduce]") {
+    std::string name = segmentName("grad");
+    std::size_t worldSize = 3;
+    int failures = forkWorkers(worldSize, [&](std::size_t rank) {
+        VariableRegistry<double> params;
+        std::vector<double> values{1.0, 2.0};
+        params.assign(values.data(), values.size());
+        SharedAllreduce<double> reducer(name, rank, worldSize, params.size());
+
+        // each worker sees a different sample
+        double sample = rank + 1.0;
+        ddouble loss = square(params[0] * sample - params[1]);
+        std::vector<double> grad(params.size());
+        reducer.allreduceGradient(params, loss, grad.data());
+
+        // d/da sum_s (a s - b)^2 = sum_s 2 s (a s - b), d/db = -sum 2 (a s - b)
+        double dA = 0;
+        double dB = 0;
+        for (double s = 1; s <= 3; s++) {
+            dA += 2 * s * (s - 2);
+            dB -= 2 * (s - 2);
+        }
+        return grad[0] == dA && grad[1] == dB;
+    });
+    REQUIRE(failures == 0);
+}
+
+TEST_CASE("Test shared allreduce layout mismatch", "[SharedAllreduce]") {
+    std::string name = segmentName("mismatch");
+    SharedAllreduce<double> reducer(name, 0, 2, 10);
+    REQUIRE_THROWS_AS(SharedAllreduce<double>(name, 1, 2, 11),
+                      std::invalid_argument);
+    REQUIRE_THROWS_AS(SharedAllreduce<double>(name, 2, 2, 10),
+                      std::invalid_argument);
+}
+
+TEST_CASE("Shared allreduce Benchmark", "[SharedAllreduce][Benchmark]") {
+    std::size_t worldSize = 4;
+    std::size_t count = 1 << 18;
+    std::string name = segmentName("bench");
+    std::vector<std::unique_ptr<SharedAllreduce<double>>> reducers;
+    for (std::size_t rank = 0; rank < worldSize; rank++) {
+        reducers.push_back(std::make_unique<SharedAllreduce<double>>(
+            name, rank, worldSize, count));
+    }
+    std::vector<std::vector<double>> data(worldSize,
+                                          std::vector<double>(count, 1.0));
+    auto run = [&](const std::function<void(std::size_t)> &worker) {
+        std::vector<std::thread> threads;
+        for (std::size_t rank = 0; rank < worldSize; rank++) {
+            threads.emplace_back(worker, rank);
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+    };
+
+    BENCHMARK("Reduce-scatter and allgather") {
+        run([&](std::size_t rank) {
+            reducers[rank]->allreduce(data[rank].data());
+        });
+    };
+
+    std::vector<std::vector<double>> slots(worldSize,
+                                           std::vector<double>(count));
+    impl::SpinBarrier barrier;
+    BENCHMARK("Naive copy and sum") {
+        run([&](std::size_t rank) {
+            naiveAllreduce(slots, barrier, rank, data[rank]);
+        });
+    };
+}
+
+#endif
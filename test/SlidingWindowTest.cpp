@@ -0,0 +1,125 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../src/Core.h"
+#include "../src/SlidingWindow.h"
+#include "LiveCountingResource.h"
+
+using namespace leningrad;
+
+namespace {
+double observation(std::size_t t) { return std::sin(0.1 * t); }
+
+// a small recurrent model, with params = (w, u, b)
+std::vector<ddouble> step(const std::vector<ddouble> &state,
+                          const std::vector<ddouble> &params, std::size_t t) {
+    ddouble x = observation(t);
+    return {tanh(params[0] * state[0] + params[1] * x + params[2]),
+            0.9 * state[1] + state[0] * x};
+}
+
+ddouble loss(const std::vector<ddouble> &state, std::size_t t) {
+    return square(state[0] - observation(t + 1)) + 0.1 * state[1];
+}
+} // namespace
+
+TEST_CASE("Test Truncated Gradients", "[SlidingWindow]") {
+    std::vector<ddouble> params{0.8, 0.5, -0.1};
+    std::size_t length = 5;
+    SlidingWindow<double> window(length);
+    std::vector<ddouble> state{0.0, 0.0};
+    std::vector<std::vector<double>> history{{0.0, 0.0}};
+
+    for (std::size_t t = 0; t < 40; t++) {
+        state = step(state, params, t);
+        window.push(state);
+        history.push_back({state[0].value(), state[1].value()});
+        REQUIRE(window.size() == std::min(t + 1, length));
+
+        // the same steps, replayed from a fresh copy of the state the window
+        // was cut at
+        std::size_t start = t + 1 - window.size();
+        std::vector<ddouble> replayed{history[start][0], history[start][1]};
+        for (std::size_t s = start; s <= t; s++) {
+            replayed = step(replayed, params, s);
+        }
+
+        ddouble actual = loss(state, t);
+        ddouble expected = loss(replayed, t);
+        REQUIRE(actual.value() == Approx(expected.value()));
+        auto actualGradient = gradient(actual);
+        auto expectedGradient = gradient(expected);
+        for (const ddouble &param : params) {
+            REQUIRE(actualGradient.wrt(param) ==
+                    Approx(expectedGradient.wrt(param)).margin(1e-12));
+        }
+        // symbolic derivatives stop at the cut too
+        REQUIRE(differentiate(actual).wrt(params[0]).value() ==
+                Approx(expectedGradient.wrt(params[0])).margin(1e-12));
+    }
+
+    window.truncate();
+    REQUIRE(window.size() == 0);
+    REQUIRE(gradient(state[0]).wrt(params[0]) == 0);
+    REQUIRE_THROWS_AS(SlidingWindow<double>(0), std::invalid_argument);
+}
+
+TEST_CASE("Test Sliding Window Memory", "[SlidingWindow]") {
+    std::vector<long> live;
+    for (std::size_t steps : {100, 1000}) {
+        LiveCountingResource resource;
+        {
+            NodeResourceScope scope(&resource);
+            std::vector<ddouble> params{0.8, 0.5, -0.1};
+            SlidingWindow<double> window(8);
+            std::vector<ddouble> state{0.0, 0.0};
+            for (std::size_t t = 0; t < steps; t++) {
+                state = step(state, params, t);
+                window.push(state);
+                // the derivative graphs go with their results, and leave
+                // nothing behind on the window's nodes
+                auto dw = differentiate(loss(state, t)).wrt(params[0]);
+                REQUIRE(std::isfinite(dw.value()));
+            }
+            live.push_back(resource.live);
+        }
+        REQUIRE(resource.live == 0);
+    }
+    REQUIRE(live[0] == live[1]);
+}
+
+TEST_CASE("Sliding Window Benchmark", "[SlidingWindow][Benchmark]") {
+    std::vector<ddouble> params{0.8, 0.5, -0.1};
+
+    // the cost of the last steps of a stream of each length
+    for (std::size_t steps : {100, 400}) {
+        BENCHMARK("Window Of 16, Stream Of " + std::to_string(steps)) {
+            SlidingWindow<double> window(16);
+            std::vector<ddouble> state{0.0, 0.0};
+            double total = 0;
+            for (std::size_t t = 0; t < steps; t++) {
+                state = step(state, params, t);
+                window.push(state);
+                total += gradient(loss(state, t)).wrt(params[0]);
+            }
+            return total / steps;
+        };
+
+        BENCHMARK("Untruncated, Stream Of " + std::to_string(steps)) {
+            std::vector<ddouble> state{0.0, 0.0};
+            double total = 0;
+            for (std::size_t t = 0; t < steps; t++) {
+                state = step(state, params, t);
+                total += gradient(loss(state, t)).wrt(params[0]);
+            }
+            return total / steps;
+        };
+    }
+}
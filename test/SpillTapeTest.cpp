@@ -0,0 +1,107 @@
+#include <catch2/catch.hpp>
+
+#include <cmath>
+#include <vector>
+
+#include "../src/Core.h"
+#include "../src/SpillTape.h"
+#include "LiveCountingResource.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+
+using namespace leningrad;
+
+namespace {
+// a long recurrence mixing a few parameters, with a fresh constant leaf and
+// an outside node in every step
+ddouble simulate(const std::vector<ddouble> &params, const ddouble &outside,
+                 int steps) {
+    ddouble state = params[0];
+    for (int i = 0; i < steps; i++) {
+        ddouble forcing = 0.001 * i;
+        state = state + 0.01 * (params[1] * sin(state) - params[2] * state +
+                                forcing * outside);
+    }
+    return square(state) + params[0] * outside;
+}
+} // namespace
+
+TEST_CASE("Test spilled gradient matches in-memory gradient", "[SpillTape]") {
+    std::vector<ddouble> params{0.5, 1.3, 0.2};
+    ddouble a = 1.1;
+    // an interior node created before the tape
+    ddouble outside = a * a;
+    int steps = 5000;
+
+    auto reference = gradient(simulate(params, outside, steps));
+
+    SpillTape<double> tape(16 * 1024);
+    ddouble loss = simulate(params, outside, steps);
+    REQUIRE(tape.spilledNodes() > 0);
+    std::size_t total = tape.spilledNodes();
+    REQUIRE(tape.peakResidentBytes() <= 16 * 1024 + 1024);
+    REQUIRE(tape.spilledBytes() > 5 * 16 * 1024);
+    REQUIRE(total > 1000);
+
+    auto grad = tape.gradient(loss);
+    for (const ddouble &p : params) {
+        REQUIRE(grad.wrt(p) == Approx(reference.wrt(p)));
+    }
+    REQUIRE(grad.wrt(outside) == Approx(reference.wrt(outside)));
+    REQUIRE(grad.wrt(a) == Approx(reference.wrt(a)));
+    REQUIRE(grad.wrt(loss) == 1);
+
+    // gradients can be taken again, of other values
+    auto again = tape.gradient(loss * 2);
+    REQUIRE(again.wrt(params[1]) == Approx(2 * reference.wrt(params[1])));
+}
+
+TEST_CASE("Test spilling frees nodes", "[SpillTape]") {
+    std::vector<ddouble> params{0.5, 1.3, 0.2};
+    ddouble outside = 1.5;
+    LiveCountingResource resource;
+    NodeResourceScope scope(&resource);
+    long unbounded;
+    {
+        ddouble loss = simulate(params, outside, 5000);
+        unbounded = resource.live;
+    }
+    REQUIRE(resource.live == 0);
+
+    SpillTape<double> tape(16 * 1024);
+    ddouble loss = simulate(params, outside, 5000);
+    REQUIRE(unbounded > 20000);
+    REQUIRE(resource.live < 1000);
+}
+
+TEST_CASE("Test spilled root", "[SpillTape]") {
+    ddouble x = 0.3;
+    double expected;
+    {
+        ddouble y = x;
+        for (int i = 0; i < 100; i++) {
+            y = sin(y) + x;
+        }
+        expected = gradient(y).wrt(x);
+    }
+
+    // a budget so small that every node is spilled as soon as it's made
+    SpillTape<double> tape(1);
+    ddouble y = x;
+    for (int i = 0; i < 100; i++) {
+        y = sin(y) + x;
+    }
+    REQUIRE(tape.residentBytes() == 0);
+    REQUIRE(tape.gradient(y).wrt(x) == Approx(expected));
+}
+
+TEST_CASE("Test no spilling under budget", "[SpillTape]") {
+    SpillTape<double> tape(1 << 20);
+    ddouble x = 2;
+    ddouble y = x * x * x;
+    REQUIRE(tape.spilledNodes() == 0);
+    REQUIRE(tape.gradient(y).wrt(x) == Approx(12));
+    REQUIRE(differentiate(y).wrt(x).value() == Approx(12));
+}
+
+#endif
@@ -0,0 +1,80 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <cmath>
+
+#include "../src/Core.h"
+#include "../src/StaticDiff.h"
+
+using namespace leningrad;
+
+namespace {
+constexpr expr::Var<0> X;
+constexpr expr::Var<1> Y;
+
+// the same function, written once for the compile time and runtime modes
+template <typename U, typename V> constexpr auto f(const U &x, const V &y) {
+    return sin(x * y) + exp(x) / y - 3. * square(x) + sqrt(y) * tanh(x);
+}
+} // namespace
+
+TEST_CASE("Test static polynomial derivatives at compile time",
+          "[StaticDiff]") {
+    constexpr auto p = X * X * Y + 3 * X - Y / 2;
+    static_assert(p(2.0, 4.0) == 20.0);
+    static_assert(expr::diff<0>(p)(2.0, 4.0) == 19.0);
+    static_assert(expr::diff<1>(p)(2.0, 4.0) == 3.5);
+    static_assert(expr::diff<0, 0>(p)(2.0, 4.0) == 8.0);
+    static_assert(expr::diff<0, 1>(p)(2.0, 4.0) == 4.0);
+    static_assert(expr::diff<0, 0, 0>(p)(2.0, 4.0) == 0.0);
+    static_assert(std::is_same_v<decltype(expr::diff<1, 1>(p)), expr::Zero>);
+}
+
+TEST_CASE("Test static derivatives match runtime derivatives",
+          "[StaticDiff]") {
+    constexpr auto fs = f(X, Y);
+    for (double xv : {-1.3, 0.2, 0.9}) {
+        for (double yv : {0.5, 2.0}) {
+            ddouble x = xv;
+            ddouble y = yv;
+            ddouble z = f(x, y);
+            REQUIRE(fs(xv, yv) == Approx(z.value()));
+
+            auto grad = expr::gradient<2>(fs)(xv, yv);
+            auto dz = differentiate(z);
+            REQUIRE(grad[0] == Approx(dz.wrt(x).value()));
+            REQUIRE(grad[1] == Approx(dz.wrt(y).value()));
+
+            REQUIRE(expr::diff<0, 1>(fs)(xv, yv) ==
+                    Approx(differentiate(z, {x, y}).value()));
+            REQUIRE(expr::diff<0, 0, 0>(fs)(xv, yv) ==
+                    Approx(differentiate(z, x, 3).value()));
+        }
+    }
+}
+
+TEST_CASE("Test static derivatives of elementary functions", "[StaticDiff]") {
+    double x = 0.7;
+    REQUIRE(expr::diff<0>(cos(X))(x) == Approx(-std::sin(x)));
+    REQUIRE(expr::diff<0>(tan(X))(x) == Approx(1 / std::pow(std::cos(x), 2)));
+    REQUIRE(expr::diff<0>(log(X))(x) == Approx(1 / x));
+    REQUIRE(expr::diff<0>(sinh(X))(x) == Approx(std::cosh(x)));
+    REQUIRE(expr::diff<0>(cosh(X))(x) == Approx(std::sinh(x)));
+    REQUIRE(expr::diff<0>(pow(X, 2.5))(x) == Approx(2.5 * std::pow(x, 1.5)));
+    REQUIRE(expr::diff<0>(expr::pow<-2>(X))(x) == Approx(-2 / (x * x * x)));
+    REQUIRE(expr::diff<0>(-(-X))(x) == 1);
+    REQUIRE(expr::diff<0>(X)(1.5f) == 1.f);
+}
+
+TEST_CASE("Static Derivative Benchmark", "[StaticDiff][Benchmark]") {
+    constexpr auto fs = f(X, Y);
+    auto grad = expr::gradient<2>(fs);
+    BENCHMARK("Static gradient") { return grad(0.3, 1.7); };
+
+    BENCHMARK("Runtime gradient") {
+        ddouble x = 0.3;
+        ddouble y = 1.7;
+        auto dz = differentiate(f(x, y));
+        return dz.wrt(x).value() + dz.wrt(y).value();
+    };
+}
@@ -0,0 +1,112 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <vector>
+
+#include "../src/Core.h"
+#include "../src/VariableRegistry.h"
+
+using namespace leningrad;
+
+namespace {
+ddouble rosenbrock(const std::vector<ddouble> &x) {
+    Accumulator<double> acc;
+    for (std::size_t i = 0; i + 1 < x.size(); i++) {
+        acc += 100. * square(x[i + 1] - x[i] * x[i]) + square(1. - x[i]);
+    }
+    return acc.sum();
+}
+} // namespace
+
+TEST_CASE("Test variable registry ids", "[VariableRegistry]") {
+    VariableRegistry<double> registry;
+    ddouble a = registry.add(1.5);
+    ddouble b = registry.add(-2);
+    REQUIRE(registry.size() == 2);
+    REQUIRE(registry.idOf(registry[0]) == 0);
+    REQUIRE(registry.idOf(registry[1]) == 1);
+    REQUIRE(registry[0].value() == 1.5);
+    REQUIRE(b.value() == -2);
+
+    ddouble other = 3;
+    REQUIRE(registry.idOf(other) == registry.size());
+    VariableRegistry<double> registry2;
+    ddouble c = registry2.add(0);
+    REQUIRE(registry.idOf(c) == registry.size());
+    REQUIRE(registry.idOf(a * 2.) == registry.size());
+}
+
+TEST_CASE("Test reassigned variable registry", "[VariableRegistry]") {
+    std::vector<double> values{1, 2, 3};
+    VariableRegistry<double> registry;
+    registry.assign(values.data(), values.size());
+    std::vector<ddouble> old(registry.begin(), registry.end());
+
+    values = {5};
+    registry.assign(values.data(), 1);
+    REQUIRE(registry.idOf(old[0]) == registry.size());
+    REQUIRE(registry.idOf(old[2]) == registry.size());
+    REQUIRE(registry.idOf(registry[0]) == 0);
+
+    // the old leaves are plain variables now, and don't take the new
+    // variables' slots or write past the end of the buffer
+    ddouble f = registry[0] * old[0] + 100. * old[0] + old[2] * old[2];
+    std::vector<double> grad = registry.gradient(f);
+    REQUIRE(grad.size() == 1);
+    REQUIRE(grad[0] == 1);
+}
+
+TEST_CASE("Test bulk gradient extraction", "[VariableRegistry]") {
+    std::vector<double> values{0.5, -1.2, 2.0, 0.1, 0.7};
+    VariableRegistry<double> registry;
+    registry.assign(values.data(), values.size());
+    ddouble unused = registry.add(4);
+    std::vector<ddouble> x(registry.begin(), registry.end() - 1);
+    ddouble f = rosenbrock(x);
+
+    auto expected = differentiate(f);
+    std::vector<double> grad = registry.gradient(f);
+    REQUIRE(grad.size() == 6);
+    for (std::size_t i = 0; i < x.size(); i++) {
+        REQUIRE(grad[i] == Approx(expected.wrt(x[i]).value()));
+    }
+    REQUIRE(grad[5] == 0);
+
+    std::vector<double> fromSpan(x.size() + 1);
+    x.push_back(unused);
+    gradient(f, x.begin(), x.end(), fromSpan.data());
+    for (std::size_t i = 0; i < x.size(); i++) {
+        REQUIRE(fromSpan[i] == grad[i]);
+    }
+}
+
+TEST_CASE("Gradient Extraction Benchmark",
+          "[VariableRegistry][Benchmark]") {
+    std::vector<double> values(10000, 0.5);
+    VariableRegistry<double> registry;
+    registry.assign(values.data(), values.size());
+    std::vector<ddouble> x(registry.begin(), registry.end());
+    ddouble f = rosenbrock(x);
+    std::vector<double> out(x.size());
+
+    BENCHMARK("wrt() per variable") {
+        auto result = differentiate(f);
+        for (std::size_t i = 0; i < x.size(); i++) {
+            out[i] = result.wrt(x[i]).value();
+        }
+        return out[0];
+    };
+
+    BENCHMARK("gradient() wrt() per variable") {
+        auto result = gradient(f);
+        for (std::size_t i = 0; i < x.size(); i++) {
+            out[i] = result.wrt(x[i]);
+        }
+        return out[0];
+    };
+
+    BENCHMARK("Registry bulk gradient") {
+        registry.gradient(f, out.data());
+        return out[0];
+    };
+}